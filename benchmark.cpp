@@ -1,9 +1,13 @@
 ///
 /// @file  benchmark.cpp
-/// @brief Simple benchmark program for libpopcnt.h, repeatedly
-///        counts the 1 bits inside a vector.
+/// @brief Benchmark program for libpopcnt.h. By default it sweeps
+///        array sizes from 8 bytes up to DRAM sized arrays for
+///        all popcount algorithms supported by the CPU and
+///        reports the median, min and standard deviation of the
+///        throughput and the number of cycles per byte.
 ///
-/// Usage: ./benchmark [array bytes] [iters]
+/// Usage: ./benchmark [options]
+///        ./benchmark [array bytes] [iters]
 ///
 /// Copyright (C) 2019 Kim Walisch, <kim.walisch@gmail.com>
 ///
@@ -13,26 +17,1383 @@
 
 #include <libpopcnt.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
 #include <iostream>
 #include <iomanip>
+#include <sstream>
 #include <vector>
 #include <cstdlib>
-#include <ctime>
 #include <stdint.h>
 #include <string>
+#include <thread>
+
+#if (__cplusplus >= 202002L || \
+     (defined(_MSVC_LANG) && _MSVC_LANG >= 202002L)) && \
+    __has_include(<bit>)
+  #include <bit>
+#endif
+
+#if defined(LIBPOPCNT_X86_OR_X64)
+  #if defined(_MSC_VER)
+    #include <intrin.h>
+  #else
+    #include <x86intrin.h>
+  #endif
+  #define BENCHMARK_HAVE_RDTSC
+#endif
+
+#if defined(__linux__) && \
+    __has_include(<linux/perf_event.h>)
+  #include <linux/perf_event.h>
+  #include <sys/ioctl.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+  #define BENCHMARK_HAVE_PERF
+#endif
+
+#if defined(__linux__)
+  #include <pthread.h>
+  #include <sched.h>
+  #define BENCHMARK_HAVE_AFFINITY
+#endif
 
 double get_seconds()
 {
-  return (double) std::clock() / CLOCKS_PER_SEC;
+  auto now = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(now.time_since_epoch()).count();
+}
+
+// Returns the CPU's time stamp counter or 0 if unavailable
+uint64_t get_cycles()
+{
+#if defined(BENCHMARK_HAVE_RDTSC)
+  return __rdtsc();
+#else
+  return 0;
+#endif
 }
 
+/// Hardware performance counters using perf_event_open(). Counters
+/// that are not supported by the CPU, the kernel or that are not
+/// permitted (e.g. in containers or with perf_event_paranoid)
+/// are reported as unavailable.
+class perf_counters
+{
+public:
+  enum { CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, TASK_CLOCK, COUNT };
+
+  perf_counters()
+  {
+    for (int i = 0; i < COUNT; i++)
+    {
+      fds_[i] = -1;
+      values_[i] = 0;
+    }
+  }
+
+  ~perf_counters()
+  {
+#if defined(BENCHMARK_HAVE_PERF)
+    for (int i = 0; i < COUNT; i++)
+      if (fds_[i] >= 0)
+        close(fds_[i]);
+#endif
+  }
+
+  /// Returns false if no hardware counter is available
+  bool open()
+  {
+#if defined(BENCHMARK_HAVE_PERF)
+    uint64_t l1d_miss = PERF_COUNT_HW_CACHE_L1D |
+                       (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                       (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+    fds_[CYCLES] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    fds_[INSTRUCTIONS] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    fds_[L1D_MISSES] = open_event(PERF_TYPE_HW_CACHE, l1d_miss);
+    fds_[LLC_MISSES] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    fds_[TASK_CLOCK] = open_event(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+#endif
+
+    return available(CYCLES) ||
+           available(INSTRUCTIONS) ||
+           available(L1D_MISSES) ||
+           available(LLC_MISSES);
+  }
+
+  bool available(int i) const
+  {
+    return fds_[i] >= 0;
+  }
+
+  void start()
+  {
+#if defined(BENCHMARK_HAVE_PERF)
+    for (int i = 0; i < COUNT; i++)
+    {
+      if (fds_[i] >= 0)
+      {
+        ioctl(fds_[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(fds_[i], PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+#endif
+  }
+
+  void stop()
+  {
+#if defined(BENCHMARK_HAVE_PERF)
+    for (int i = 0; i < COUNT; i++)
+      if (fds_[i] >= 0)
+        ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    for (int i = 0; i < COUNT; i++)
+    {
+      // value, time enabled, time running
+      uint64_t data[3] = { 0, 0, 0 };
+
+      if (fds_[i] >= 0 &&
+          read(fds_[i], data, sizeof(data)) == (ssize_t) sizeof(data))
+      {
+        // Scale the value if the counters were multiplexed
+        values_[i] = (double) data[0];
+        if (data[2] > 0 && data[2] < data[1])
+          values_[i] *= (double) data[1] / (double) data[2];
+      }
+    }
+#endif
+  }
+
+  /// The value of counter i between start() and stop(),
+  /// the task clock is in nanoseconds.
+  double value(int i) const
+  {
+    return values_[i];
+  }
+
+private:
+#if defined(BENCHMARK_HAVE_PERF)
+  static int open_event(uint32_t type, uint64_t config)
+  {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+#endif
+
+  int fds_[COUNT];
+  double values_[COUNT];
+};
+
 // init vector with random data
 void init(std::vector<uint8_t>& vect)
 {
-  std::srand((unsigned) std::time(0));
+  uint64_t x = 0x9E3779B97F4A7C15ull ^ (uint64_t) get_seconds();
 
   for (size_t i = 0; i < vect.size(); i++)
-    vect[i] = (uint8_t) std::rand();
+  {
+    // xorshift64, much faster than std::rand() for huge arrays
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    vect[i] = (uint8_t) x;
+  }
+}
+
+std::string format_size(uint64_t bytes)
+{
+  const char* units[] = { "B", "KiB", "MiB", "GiB" };
+  double size = (double) bytes;
+  int u = 0;
+
+  for (; u < 3 && bytes >= (1ull << (10 * (u + 1))); u++)
+    size /= 1024;
+
+  std::ostringstream oss;
+
+  if (bytes % (1ull << (10 * u)) == 0)
+    oss << (uint64_t) size << " " << units[u];
+  else
+    oss << std::fixed << std::setprecision(2) << size << " " << units[u];
+
+  return oss.str();
+}
+
+/// Count the 1 bits using the POPCNT instruction, or
+/// the integer algorithm on CPUs without POPCNT.
+uint64_t popcnt_scalar(const uint8_t* ptr, uint64_t size)
+{
+  uint64_t cnt = 0;
+  uint64_t i = 0;
+
+  for (; i + 8 <= size; i += 8)
+    cnt += popcnt64(load64(&ptr[i]));
+  if (i < size)
+    cnt += popcnt64(load64_partial(&ptr[i], size - i));
+
+  return cnt;
+}
+
+uint64_t popcnt_integer(const uint8_t* ptr, uint64_t size)
+{
+  uint64_t cnt = 0;
+  uint64_t i = 0;
+
+  for (; i + 8 <= size; i += 8)
+    cnt += popcnt64_bitwise(load64(&ptr[i]));
+  if (i < size)
+    cnt += popcnt64_bitwise(load64_partial(&ptr[i], size - i));
+
+  return cnt;
+}
+
+/*
+ * Baseline kernels, plain loops that do not use libpopcnt.h.
+ * These show whether the library's kernels still beat what
+ * the compiler generates e.g. using -march=native.
+ */
+
+#if defined(__clang__)
+  #define BENCHMARK_NO_VECTORIZE _Pragma("clang loop vectorize(disable) interleave(disable)")
+  #define BENCHMARK_VECTORIZE _Pragma("clang loop vectorize(enable) interleave(enable)")
+  #define BENCHMARK_SCALAR_FUNC
+  #define BENCHMARK_VECTOR_FUNC
+#elif defined(__GNUC__)
+  #define BENCHMARK_NO_VECTORIZE
+  #define BENCHMARK_VECTORIZE
+  #define BENCHMARK_SCALAR_FUNC __attribute__ ((optimize ("no-tree-vectorize")))
+  #define BENCHMARK_VECTOR_FUNC __attribute__ ((optimize ("O3")))
+#else
+  #define BENCHMARK_NO_VECTORIZE
+  #define BENCHMARK_VECTORIZE
+  #define BENCHMARK_SCALAR_FUNC
+  #define BENCHMARK_VECTOR_FUNC
+#endif
+
+#if defined(LIBPOPCNT_HAVE_BUILTIN_POPCOUNT)
+
+/// Scalar loop using __builtin_popcountll(), vectorization disabled
+BENCHMARK_SCALAR_FUNC
+uint64_t popcnt_builtin(const uint8_t* ptr, uint64_t size)
+{
+  uint64_t cnt = 0;
+  uint64_t i = 0;
+
+  BENCHMARK_NO_VECTORIZE
+  for (; i + 8 <= size; i += 8)
+    cnt += __builtin_popcountll(load64(&ptr[i]));
+  if (i < size)
+    cnt += __builtin_popcountll(load64_partial(&ptr[i], size - i));
+
+  return cnt;
+}
+
+/// The same loop, vectorized by the compiler if possible
+BENCHMARK_VECTOR_FUNC
+uint64_t popcnt_autovec(const uint8_t* ptr, uint64_t size)
+{
+  uint64_t cnt = 0;
+  uint64_t i = 0;
+
+  BENCHMARK_VECTORIZE
+  for (; i + 8 <= size; i += 8)
+    cnt += __builtin_popcountll(load64(&ptr[i]));
+  if (i < size)
+    cnt += __builtin_popcountll(load64_partial(&ptr[i], size - i));
+
+  return cnt;
+}
+
+#endif
+
+#if defined(__cpp_lib_bitops)
+
+/// Loop using C++20 std::popcount()
+uint64_t popcnt_std(const uint8_t* ptr, uint64_t size)
+{
+  uint64_t cnt = 0;
+  uint64_t i = 0;
+
+  for (; i + 8 <= size; i += 8)
+    cnt += std::popcount(load64(&ptr[i]));
+  if (i < size)
+    cnt += std::popcount(load64_partial(&ptr[i], size - i));
+
+  return cnt;
+}
+
+#endif
+
+uint64_t popcnt_dispatch(const uint8_t* ptr, uint64_t size)
+{
+  return popcnt(ptr, size);
+}
+
+#if defined(LIBPOPCNT_HAVE_AVX2)
+
+uint64_t popcnt_forced_avx2(const uint8_t* ptr, uint64_t size)
+{
+  uint64_t i = size - size % 32;
+  return popcnt_avx2((const __m256i*) ptr, size / 32) +
+         popcnt_scalar(&ptr[i], size - i);
+}
+
+#endif
+
+#if defined(LIBPOPCNT_HAVE_AVX512)
+
+uint64_t popcnt_forced_avx512(const uint8_t* ptr, uint64_t size)
+{
+  return popcnt_avx512(ptr, size);
+}
+
+#endif
+
+/// A popcount algorithm, the library's popcnt() uses
+/// runtime dispatching, the other kernels are forced.
+struct kernel
+{
+  std::string name;
+  uint64_t (*func)(const uint8_t*, uint64_t);
+  bool baseline;
+};
+
+std::vector<kernel> get_kernels()
+{
+  std::vector<kernel> kernels;
+  int cpuid = get_cpuid_flags();
+  (void) cpuid;
+
+  kernels.push_back(kernel{"popcnt", popcnt_dispatch, false});
+
+#if defined(LIBPOPCNT_HAVE_AVX512)
+  if (cpuid & LIBPOPCNT_BIT_AVX512_VPOPCNTDQ)
+    kernels.push_back(kernel{"AVX512", popcnt_forced_avx512, false});
+#endif
+
+#if defined(LIBPOPCNT_HAVE_AVX2)
+  if (cpuid & LIBPOPCNT_BIT_AVX2)
+    kernels.push_back(kernel{"AVX2", popcnt_forced_avx2, false});
+#endif
+
+#if defined(LIBPOPCNT_HAVE_POPCNT)
+  if (cpuid & LIBPOPCNT_BIT_POPCNT)
+    kernels.push_back(kernel{"POPCNT", popcnt_scalar, false});
+#endif
+
+  kernels.push_back(kernel{"integer", popcnt_integer, false});
+
+  // The integer kernel is the popcnt64_bitwise() loop baseline
+#if defined(LIBPOPCNT_HAVE_BUILTIN_POPCOUNT)
+  kernels.push_back(kernel{"builtin", popcnt_builtin, true});
+  kernels.push_back(kernel{"autovec", popcnt_autovec, true});
+#endif
+#if defined(__cpp_lib_bitops)
+  kernels.push_back(kernel{"std", popcnt_std, true});
+#endif
+
+  return kernels;
+}
+
+struct options
+{
+  std::vector<uint64_t> sizes;
+  std::vector<uint64_t> aligns;
+  std::vector<std::string> kernels;
+  uint64_t max_size = 256ull << 20;
+  int reps = 11;
+  double rep_seconds = 0.002;
+  std::string format = "text";
+  bool perf = false;
+  std::string output;
+  double threshold = 5;
+  uint64_t latency_min = 0;
+  uint64_t latency_max = 0;
+  int threads = 0;
+};
+
+volatile uint64_t sink;
+
+/// The measurements of one kernel, size & alignment
+struct result
+{
+  std::string kernel;
+  uint64_t size;
+  uint64_t align;
+  int reps;
+  double median_gbs;
+  double min_gbs;
+  double stddev_gbs;
+  double cycles_per_byte;
+  // perf_event_open() counters, -1 if unavailable
+  double bytes_per_cycle;
+  double ipc;
+  double ghz;
+  double l1d_misses_per_kib;
+  double llc_misses_per_kib;
+};
+
+double median(std::vector<double> v)
+{
+  std::sort(v.begin(), v.end());
+  size_t n = v.size();
+  return (n % 2) ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+double stddev(const std::vector<double>& v)
+{
+  double mean = 0;
+  double sum = 0;
+
+  for (double x : v)
+    mean += x;
+  mean /= v.size();
+  for (double x : v)
+    sum += (x - mean) * (x - mean);
+
+  return std::sqrt(sum / v.size());
+}
+
+/// Repeatedly count the 1 bits of ptr[0, size), each repetition
+/// runs at least opts.rep_seconds. The first repetition is a
+/// warm-up run which is not measured.
+result measure(const kernel& k,
+               const uint8_t* ptr,
+               uint64_t size,
+               uint64_t align,
+               const options& opts,
+               perf_counters* perf)
+{
+  uint64_t expected = popcnt_integer(ptr, size);
+  uint64_t iters = 1;
+  uint64_t total = 0;
+
+  // Find the number of iterations per repetition
+  while (true)
+  {
+    double seconds = get_seconds();
+    for (uint64_t i = 0; i < iters; i++)
+      total += k.func(ptr, size);
+    seconds = get_seconds() - seconds;
+
+    if (seconds >= opts.rep_seconds)
+      break;
+    if (seconds * 4 < opts.rep_seconds)
+      iters *= 4;
+    else
+      iters *= 2;
+  }
+
+  std::vector<double> gbs;
+  std::vector<double> cpb;
+  std::vector<double> counters[perf_counters::COUNT];
+
+  for (int r = 0; r < opts.reps; r++)
+  {
+    uint64_t cnt = 0;
+
+    if (perf)
+      perf->start();
+
+    uint64_t cycles = get_cycles();
+    double seconds = get_seconds();
+
+    for (uint64_t i = 0; i < iters; i++)
+      cnt += k.func(ptr, size);
+
+    seconds = get_seconds() - seconds;
+    cycles = get_cycles() - cycles;
+
+    if (perf)
+    {
+      perf->stop();
+      for (int i = 0; i < perf_counters::COUNT; i++)
+        counters[i].push_back(perf->value(i) / (double) iters);
+    }
+
+    if (cnt != expected * iters)
+    {
+      std::cerr << "libpopcnt verification failed: " << k.name << ", " << size << " bytes" << std::endl;
+      std::exit(1);
+    }
+
+    double bytes = (double) size * (double) iters;
+    gbs.push_back(bytes / std::max(seconds, 1e-9) / 1e9);
+    cpb.push_back((double) cycles / bytes);
+  }
+
+  result res;
+  res.kernel = k.name;
+  res.size = size;
+  res.align = align;
+  res.reps = opts.reps;
+  res.median_gbs = median(gbs);
+  res.min_gbs = *std::min_element(gbs.begin(), gbs.end());
+  res.stddev_gbs = stddev(gbs);
+  res.cycles_per_byte = median(cpb);
+  res.bytes_per_cycle = -1;
+  res.ipc = -1;
+  res.ghz = -1;
+  res.l1d_misses_per_kib = -1;
+  res.llc_misses_per_kib = -1;
+
+  if (perf)
+  {
+    double cycles = median(counters[perf_counters::CYCLES]);
+    double instructions = median(counters[perf_counters::INSTRUCTIONS]);
+    double task_clock = median(counters[perf_counters::TASK_CLOCK]);
+    double kib = size / 1024.0;
+
+    if (perf->available(perf_counters::CYCLES) && cycles > 0)
+    {
+      res.bytes_per_cycle = size / cycles;
+      if (perf->available(perf_counters::INSTRUCTIONS))
+        res.ipc = instructions / cycles;
+      if (perf->available(perf_counters::TASK_CLOCK) && task_clock > 0)
+        res.ghz = cycles / task_clock;
+    }
+    if (perf->available(perf_counters::L1D_MISSES))
+      res.l1d_misses_per_kib = median(counters[perf_counters::L1D_MISSES]) / kib;
+    if (perf->available(perf_counters::LLC_MISSES))
+      res.llc_misses_per_kib = median(counters[perf_counters::LLC_MISSES]) / kib;
+  }
+
+  // prevent the compiler from removing the warm-up run
+  sink = total;
+
+  return res;
+}
+
+void print_header(std::ostream& out, const options& opts)
+{
+  out << std::left
+      << std::setw(10) << "Kernel"
+      << std::right
+      << std::setw(12) << "Size"
+      << std::setw(7) << "Align"
+      << std::setw(10) << "Median"
+      << std::setw(10) << "Min"
+      << std::setw(10) << "Stddev"
+      << std::setw(10) << "Cycles/B";
+
+  if (opts.perf)
+    out << std::setw(10) << "B/cycle"
+        << std::setw(8) << "IPC"
+        << std::setw(8) << "GHz"
+        << std::setw(12) << "L1D miss/K"
+        << std::setw(12) << "LLC miss/K";
+
+  out << std::endl;
+}
+
+// Print a perf counter metric or n/a
+void print_metric(std::ostream& out, int width, double value)
+{
+  if (value < 0)
+    out << std::setw(width) << "n/a";
+  else
+    out << std::setw(width) << value;
+}
+
+void print_result(std::ostream& out, const result& res, const options& opts)
+{
+  out << std::left << std::setw(10) << res.kernel
+      << std::right << std::setw(12) << format_size(res.size)
+      << std::setw(7) << res.align
+      << std::fixed << std::setprecision(2)
+      << std::setw(10) << res.median_gbs
+      << std::setw(10) << res.min_gbs
+      << std::setw(10) << res.stddev_gbs;
+
+#if defined(BENCHMARK_HAVE_RDTSC)
+  out << std::setprecision(3) << std::setw(10) << res.cycles_per_byte;
+#else
+  out << std::setw(10) << "n/a";
+#endif
+
+  if (opts.perf)
+  {
+    out << std::setprecision(2);
+    print_metric(out, 10, res.bytes_per_cycle);
+    print_metric(out, 8, res.ipc);
+    print_metric(out, 8, res.ghz);
+    print_metric(out, 12, res.l1d_misses_per_kib);
+    print_metric(out, 12, res.llc_misses_per_kib);
+  }
+
+  out << std::endl;
+}
+
+/// Returns the CPU model e.g. "AMD EPYC 9R14 96-Core Processor"
+std::string get_cpu_model()
+{
+  std::string model;
+
+#if defined(LIBPOPCNT_HAVE_RUN_CPUID)
+  int abcd[4];
+  run_cpuid((int) 0x80000000, 0, abcd);
+
+  if ((uint32_t) abcd[0] >= 0x80000004)
+  {
+    for (int i = 0; i < 3; i++)
+    {
+      run_cpuid((int) (0x80000002 + i), 0, abcd);
+      model.append((const char*) abcd, sizeof(abcd));
+    }
+
+    model = model.substr(0, model.find('\0'));
+    model.erase(0, model.find_first_not_of(' '));
+    model.erase(model.find_last_not_of(' ') + 1);
+  }
+#endif
+
+  if (model.empty())
+    model = "unknown";
+
+  return model;
+}
+
+std::string json_escape(const std::string& str)
+{
+  std::string res;
+
+  for (char c : str)
+  {
+    if (c == '"' || c == '\\')
+      res += '\\';
+    res += c;
+  }
+
+  return res;
+}
+
+void write_json(std::ostream& out, const std::string& cpu, const std::vector<result>& results)
+{
+  out << "{" << std::endl;
+  out << "  \"cpu\": \"" << json_escape(cpu) << "\"," << std::endl;
+  out << "  \"results\": [" << std::endl;
+  out << std::setprecision(6) << std::defaultfloat;
+
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    const result& res = results[i];
+    out << "    {\"kernel\": \"" << json_escape(res.kernel) << "\""
+        << ", \"size\": " << res.size
+        << ", \"align\": " << res.align
+        << ", \"reps\": " << res.reps
+        << ", \"median_gbs\": " << res.median_gbs
+        << ", \"min_gbs\": " << res.min_gbs
+        << ", \"stddev_gbs\": " << res.stddev_gbs
+        << ", \"cycles_per_byte\": " << res.cycles_per_byte;
+
+    if (res.bytes_per_cycle >= 0) out << ", \"bytes_per_cycle\": " << res.bytes_per_cycle;
+    if (res.ipc >= 0) out << ", \"ipc\": " << res.ipc;
+    if (res.ghz >= 0) out << ", \"ghz\": " << res.ghz;
+    if (res.l1d_misses_per_kib >= 0) out << ", \"l1d_misses_per_kib\": " << res.l1d_misses_per_kib;
+    if (res.llc_misses_per_kib >= 0) out << ", \"llc_misses_per_kib\": " << res.llc_misses_per_kib;
+
+    out << "}" << ((i + 1 < results.size()) ? "," : "") << std::endl;
+  }
+
+  out << "  ]" << std::endl;
+  out << "}" << std::endl;
+}
+
+void write_csv(std::ostream& out, const std::string& cpu, const std::vector<result>& results)
+{
+  out << "cpu,kernel,size,align,reps,median_gbs,min_gbs,stddev_gbs,cycles_per_byte,"
+         "bytes_per_cycle,ipc,ghz,l1d_misses_per_kib,llc_misses_per_kib" << std::endl;
+  out << std::setprecision(6) << std::defaultfloat;
+
+  // Unavailable perf counters are left empty
+  for (const result& res : results)
+  {
+    double metrics[5] = { res.bytes_per_cycle, res.ipc, res.ghz,
+                          res.l1d_misses_per_kib, res.llc_misses_per_kib };
+
+    out << "\"" << cpu << "\","
+        << res.kernel << ","
+        << res.size << ","
+        << res.align << ","
+        << res.reps << ","
+        << res.median_gbs << ","
+        << res.min_gbs << ","
+        << res.stddev_gbs << ","
+        << res.cycles_per_byte;
+
+    for (double metric : metrics)
+    {
+      out << ",";
+      if (metric >= 0)
+        out << metric;
+    }
+
+    out << std::endl;
+  }
+}
+
+/// Sweep array sizes, alignments and kernels
+void sweep(const options& opts)
+{
+  std::vector<uint64_t> sizes = opts.sizes;
+
+  if (sizes.empty())
+    for (uint64_t size = 8; size <= opts.max_size; size *= 2)
+      sizes.push_back(size);
+
+  uint64_t max_size = *std::max_element(sizes.begin(), sizes.end());
+  uint64_t max_align = *std::max_element(opts.aligns.begin(), opts.aligns.end());
+  std::vector<uint8_t> vect(max_size + max_align + 4096);
+  init(vect);
+
+  // Align the array to a page boundary
+  const uint8_t* base = &vect[0] + (4096 - (uintptr_t) &vect[0] % 4096) % 4096;
+  std::vector<kernel> kernels = get_kernels();
+  std::vector<result> results;
+  std::string cpu = get_cpu_model();
+  perf_counters counters;
+  perf_counters* perf = NULL;
+
+  // The text table is printed to stderr when the
+  // JSON or CSV results are printed to stdout.
+  std::ostream& log = (opts.format == "text" || !opts.output.empty()) ? std::cout : std::cerr;
+
+  log << "CPU: " << cpu << std::endl;
+#if defined(LIBPOPCNT_HAVE_RUN_CPUID) && \
+   (defined(LIBPOPCNT_HAVE_AVX2) || defined(LIBPOPCNT_HAVE_AVX512))
+  log << "Last level cache: " << format_size((uint64_t) get_llc_kib() << 10) << std::endl;
+#endif
+  log << "Throughput in GB/s, Cycles/B measured using "
+#if defined(BENCHMARK_HAVE_RDTSC)
+      << "RDTSC (reference cycles)"
+#else
+      << "n/a"
+#endif
+      << std::endl;
+
+  if (opts.perf)
+  {
+    if (counters.open())
+      perf = &counters;
+    else
+      log << "Performance counters: unavailable (perf_event_open failed, see perf_event_paranoid)" << std::endl;
+  }
+
+  log << std::endl;
+  print_header(log, opts);
+
+  for (uint64_t size : sizes)
+  {
+    for (uint64_t align : opts.aligns)
+    {
+      const result* best = NULL;
+      const result* best_baseline = NULL;
+      size_t first = results.size();
+
+      for (const kernel& k : kernels)
+        if (opts.kernels.empty() ||
+            std::find(opts.kernels.begin(), opts.kernels.end(), k.name) != opts.kernels.end())
+        {
+          results.push_back(measure(k, base + align, size, align, opts, perf));
+          print_result(log, results.back(), opts);
+        }
+
+      for (size_t i = first; i < results.size(); i++)
+      {
+        const kernel* k = &kernels[0];
+        for (const kernel& k2 : kernels)
+          if (k2.name == results[i].kernel)
+            k = &k2;
+
+        const result*& b = k->baseline ? best_baseline : best;
+        if (!b || results[i].median_gbs > b->median_gbs)
+          b = &results[i];
+      }
+
+      // Fastest libpopcnt kernel vs fastest baseline kernel
+      if (best && best_baseline)
+        log << "  " << best->kernel << " vs " << best_baseline->kernel << ": "
+            << std::fixed << std::setprecision(2)
+            << best->median_gbs / best_baseline->median_gbs << "x" << std::endl;
+    }
+  }
+
+  if (opts.format == "text")
+    return;
+
+  std::ofstream file;
+  if (!opts.output.empty())
+  {
+    file.open(opts.output.c_str());
+    if (!file)
+    {
+      std::cerr << "Error: failed to open " << opts.output << std::endl;
+      std::exit(1);
+    }
+  }
+
+  std::ostream& out = opts.output.empty() ? std::cout : file;
+
+  if (opts.format == "json")
+    write_json(out, cpu, results);
+  else
+    write_csv(out, cpu, results);
+}
+
+/// Returns the value of "key": value in a JSON line
+std::string json_value(const std::string& line, const std::string& key)
+{
+  size_t pos = line.find("\"" + key + "\":");
+  if (pos == std::string::npos)
+    return "";
+
+  pos = line.find_first_not_of(' ', pos + key.size() + 3);
+  if (pos == std::string::npos)
+    return "";
+
+  if (line[pos] == '"')
+  {
+    std::string value;
+    for (pos++; pos < line.size() && line[pos] != '"'; pos++)
+    {
+      if (line[pos] == '\\' && pos + 1 < line.size())
+        pos++;
+      value += line[pos];
+    }
+    return value;
+  }
+
+  size_t end = line.find_first_of(",}", pos);
+  return line.substr(pos, end - pos);
+}
+
+/// Split a CSV line, supports quoted fields
+std::vector<std::string> csv_fields(const std::string& line)
+{
+  std::vector<std::string> fields(1);
+  bool quoted = false;
+
+  for (char c : line)
+  {
+    if (c == '"')
+      quoted = !quoted;
+    else if (c == ',' && !quoted)
+      fields.push_back("");
+    else if (c != '\r')
+      fields.back() += c;
+  }
+
+  return fields;
+}
+
+/// Load the results written using --format=json or --format=csv
+std::vector<result> load_results(const std::string& filename, std::string& cpu)
+{
+  std::ifstream file(filename.c_str());
+  std::vector<result> results;
+  std::string line;
+
+  if (!file)
+  {
+    std::cerr << "Error: failed to open " << filename << std::endl;
+    std::exit(1);
+  }
+
+  while (std::getline(file, line))
+  {
+    result res = result();
+
+    if (line.find("\"cpu\":") != std::string::npos)
+      cpu = json_value(line, "cpu");
+    else if (line.find("\"kernel\":") != std::string::npos)
+    {
+      res.kernel = json_value(line, "kernel");
+      res.size = std::strtoull(json_value(line, "size").c_str(), NULL, 10);
+      res.align = std::strtoull(json_value(line, "align").c_str(), NULL, 10);
+      res.reps = std::atoi(json_value(line, "reps").c_str());
+      res.median_gbs = std::atof(json_value(line, "median_gbs").c_str());
+      res.min_gbs = std::atof(json_value(line, "min_gbs").c_str());
+      res.stddev_gbs = std::atof(json_value(line, "stddev_gbs").c_str());
+      res.cycles_per_byte = std::atof(json_value(line, "cycles_per_byte").c_str());
+      results.push_back(res);
+    }
+    else
+    {
+      std::vector<std::string> f = csv_fields(line);
+      if (f.size() < 9 || f[0] == "cpu")
+        continue;
+
+      cpu = f[0];
+      res.kernel = f[1];
+      res.size = std::strtoull(f[2].c_str(), NULL, 10);
+      res.align = std::strtoull(f[3].c_str(), NULL, 10);
+      res.reps = std::atoi(f[4].c_str());
+      res.median_gbs = std::atof(f[5].c_str());
+      res.min_gbs = std::atof(f[6].c_str());
+      res.stddev_gbs = std::atof(f[7].c_str());
+      res.cycles_per_byte = std::atof(f[8].c_str());
+      results.push_back(res);
+    }
+  }
+
+  return results;
+}
+
+/// Compare the results of two benchmark runs. A result is
+/// flagged as slower if its median throughput dropped by more
+/// than opts.threshold percent and the drop is statistically
+/// significant (> 3 standard errors). Returns the number of
+/// slower results.
+int compare(const std::string& baseline, const std::string& current, const options& opts)
+{
+  std::string cpu1, cpu2;
+  std::vector<result> base = load_results(baseline, cpu1);
+  std::vector<result> curr = load_results(current, cpu2);
+  int slower = 0;
+  int compared = 0;
+
+  std::cout << "Baseline: " << baseline << " (" << cpu1 << ")" << std::endl;
+  std::cout << "Current:  " << current << " (" << cpu2 << ")" << std::endl;
+  if (cpu1 != cpu2)
+    std::cout << "Warning: the results are from different CPUs!" << std::endl;
+  std::cout << std::endl;
+
+  std::cout << std::left << std::setw(10) << "Kernel"
+            << std::right << std::setw(12) << "Size"
+            << std::setw(7) << "Align"
+            << std::setw(10) << "Baseline"
+            << std::setw(10) << "Current"
+            << std::setw(10) << "Change"
+            << std::endl;
+
+  for (const result& b : base)
+  {
+    for (const result& c : curr)
+    {
+      if (b.kernel != c.kernel ||
+          b.size != c.size ||
+          b.align != c.align)
+        continue;
+
+      double change = (c.median_gbs - b.median_gbs) / b.median_gbs * 100;
+      double se = std::sqrt(b.stddev_gbs * b.stddev_gbs / std::max(b.reps, 1) +
+                            c.stddev_gbs * c.stddev_gbs / std::max(c.reps, 1));
+      bool is_slower = -change > opts.threshold &&
+                       b.median_gbs - c.median_gbs > 3 * se;
+
+      std::cout << std::left << std::setw(10) << b.kernel
+                << std::right << std::setw(12) << format_size(b.size)
+                << std::setw(7) << b.align
+                << std::fixed << std::setprecision(2)
+                << std::setw(10) << b.median_gbs
+                << std::setw(10) << c.median_gbs
+                << std::setprecision(1)
+                << std::setw(9) << std::showpos << change << "%" << std::noshowpos
+                << (is_slower ? "  SLOWER" : "")
+                << std::endl;
+
+      slower += is_slower;
+      compared++;
+    }
+  }
+
+  std::cout << std::endl;
+  std::cout << "Compared: " << compared << ", significantly slower: " << slower << std::endl;
+
+  return slower;
+}
+
+/// The random calls of the latency benchmark
+struct latency_calls
+{
+  std::vector<uint8_t> data;
+  std::vector<uint32_t> offsets;
+  std::vector<uint32_t> sizes;
+};
+
+/// Count the 1 bits of all calls, the kernel is a template
+/// parameter so that it can be inlined like in user code.
+template <uint64_t (*F)(const uint8_t*, uint64_t)>
+uint64_t run_calls(const latency_calls& calls)
+{
+  const uint8_t* data = &calls.data[0];
+  uint64_t cnt = 0;
+
+  for (size_t i = 0; i < calls.sizes.size(); i++)
+    cnt += F(data + calls.offsets[i], calls.sizes[i]);
+
+  return cnt;
+}
+
+struct latency_kernel
+{
+  std::string name;
+  uint64_t (*run)(const latency_calls&);
+};
+
+/// Measure the latency of popcnt() for small arrays of random
+/// sizes in [min_size, max_size] at random offsets, so that the
+/// branches of the kernels cannot be predicted.
+void latency(const options& opts)
+{
+  const size_t num_calls = 1 << 14;
+  const size_t data_size = 1 << 16;
+  uint64_t min_size = opts.latency_min;
+  uint64_t max_size = std::max(opts.latency_max, min_size);
+
+  latency_calls calls;
+  calls.data.resize(data_size + max_size);
+  init(calls.data);
+
+  uint64_t x = 0x2545F4914F6CDD1Dull;
+  uint64_t expected = 0;
+
+  for (size_t i = 0; i < num_calls; i++)
+  {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    uint32_t size = (uint32_t) (min_size + (x >> 32) % (max_size - min_size + 1));
+    uint32_t offset = (uint32_t) (x % data_size);
+    calls.sizes.push_back(size);
+    calls.offsets.push_back(offset);
+    expected += popcnt_integer(&calls.data[offset], size);
+  }
+
+  std::vector<latency_kernel> kernels;
+  int cpuid = get_cpuid_flags();
+  (void) cpuid;
+
+  kernels.push_back(latency_kernel{"popcnt", run_calls<popcnt_dispatch>});
+#if defined(LIBPOPCNT_HAVE_AVX512)
+  if (cpuid & LIBPOPCNT_BIT_AVX512_VPOPCNTDQ)
+    kernels.push_back(latency_kernel{"AVX512", run_calls<popcnt_forced_avx512>});
+#endif
+#if defined(LIBPOPCNT_HAVE_AVX2)
+  if (cpuid & LIBPOPCNT_BIT_AVX2)
+    kernels.push_back(latency_kernel{"AVX2", run_calls<popcnt_forced_avx2>});
+#endif
+#if defined(LIBPOPCNT_HAVE_POPCNT)
+  if (cpuid & LIBPOPCNT_BIT_POPCNT)
+    kernels.push_back(latency_kernel{"POPCNT", run_calls<popcnt_scalar>});
+#endif
+  kernels.push_back(latency_kernel{"integer", run_calls<popcnt_integer>});
+#if defined(LIBPOPCNT_HAVE_BUILTIN_POPCOUNT)
+  kernels.push_back(latency_kernel{"builtin", run_calls<popcnt_builtin>});
+  kernels.push_back(latency_kernel{"autovec", run_calls<popcnt_autovec>});
+#endif
+#if defined(__cpp_lib_bitops)
+  kernels.push_back(latency_kernel{"std", run_calls<popcnt_std>});
+#endif
+
+  std::cout << "Random sizes: " << min_size << " - " << max_size << " bytes, random offsets" << std::endl;
+  std::cout << "Calls per repetition: " << num_calls << std::endl;
+  std::cout << std::endl;
+  std::cout << std::left << std::setw(10) << "Kernel"
+            << std::right
+            << std::setw(12) << "ns/call"
+            << std::setw(12) << "Min"
+            << std::setw(14) << "Cycles/call"
+            << std::endl;
+
+  for (const latency_kernel& k : kernels)
+  {
+    if (!opts.kernels.empty() &&
+        std::find(opts.kernels.begin(), opts.kernels.end(), k.name) == opts.kernels.end())
+      continue;
+
+    std::vector<double> ns;
+    std::vector<double> cycles;
+    sink = k.run(calls);
+
+    for (int r = 0; r < opts.reps; r++)
+    {
+      uint64_t iters = 0;
+      uint64_t cnt = 0;
+      uint64_t c = get_cycles();
+      double seconds = get_seconds();
+      double elapsed = 0;
+
+      while (elapsed < opts.rep_seconds)
+      {
+        cnt += k.run(calls);
+        iters++;
+        elapsed = get_seconds() - seconds;
+      }
+
+      c = get_cycles() - c;
+
+      if (cnt != expected * iters)
+      {
+        std::cerr << "libpopcnt verification failed: " << k.name << std::endl;
+        std::exit(1);
+      }
+
+      double total_calls = (double) num_calls * (double) iters;
+      ns.push_back(elapsed * 1e9 / total_calls);
+      cycles.push_back((double) c / total_calls);
+    }
+
+    std::cout << std::left << std::setw(10) << k.name
+              << std::right << std::fixed << std::setprecision(2)
+              << std::setw(12) << median(ns)
+              << std::setw(12) << *std::min_element(ns.begin(), ns.end());
+#if defined(BENCHMARK_HAVE_RDTSC)
+    std::cout << std::setw(14) << median(cycles);
+#else
+    std::cout << std::setw(14) << "n/a";
+#endif
+    std::cout << std::endl;
+  }
+}
+
+#if defined(LIBPOPCNT_HAVE_AVX2)
+
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+uint64_t read_words_avx2(const uint8_t* ptr, uint64_t size)
+{
+  __m256i sum0 = _mm256_setzero_si256();
+  __m256i sum1 = _mm256_setzero_si256();
+  uint64_t i = 0;
+
+  for (; i + 64 <= size; i += 64)
+  {
+    sum0 = _mm256_add_epi64(sum0, _mm256_loadu_si256((const __m256i*) &ptr[i + 0]));
+    sum1 = _mm256_add_epi64(sum1, _mm256_loadu_si256((const __m256i*) &ptr[i + 32]));
+  }
+
+  uint64_t tmp[4];
+  _mm256_storeu_si256((__m256i*) tmp, _mm256_add_epi64(sum0, sum1));
+  uint64_t sum = tmp[0] + tmp[1] + tmp[2] + tmp[3];
+
+  for (; i < size; i++)
+    sum += ptr[i];
+
+  return sum;
+}
+
+#endif
+
+/// Memory read bandwidth baseline (like STREAM), sums the
+/// 64-bit words of the array.
+uint64_t read_words(const uint8_t* ptr, uint64_t size)
+{
+#if defined(LIBPOPCNT_HAVE_AVX2)
+  if (get_cpuid_flags() & LIBPOPCNT_BIT_AVX2)
+    return read_words_avx2(ptr, size);
+#endif
+
+  uint64_t sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+  uint64_t i = 0;
+
+  for (; i + 32 <= size; i += 32)
+  {
+    sum0 += load64(&ptr[i + 0]);
+    sum1 += load64(&ptr[i + 8]);
+    sum2 += load64(&ptr[i + 16]);
+    sum3 += load64(&ptr[i + 24]);
+  }
+  for (; i < size; i++)
+    sum0 += ptr[i];
+
+  return sum0 + sum1 + sum2 + sum3;
+}
+
+/// Returns the CPUs this process may run on
+std::vector<int> get_cpus()
+{
+  std::vector<int> cpus;
+
+#if defined(BENCHMARK_HAVE_AFFINITY)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+      if (CPU_ISSET(cpu, &set))
+        cpus.push_back(cpu);
+#endif
+
+  if (cpus.empty())
+    for (int cpu = 0; cpu < (int) std::max(1u, std::thread::hardware_concurrency()); cpu++)
+      cpus.push_back(cpu);
+
+  return cpus;
+}
+
+/// Pin the calling thread to the CPU, no-op if unsupported
+void pin_thread(int cpu)
+{
+#if defined(BENCHMARK_HAVE_AFFINITY)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+  (void) cpu;
+#endif
+}
+
+/// Run func concurrently on the pinned threads for the given
+/// number of seconds and return the aggregate GB/s.
+/// Private: each thread allocates and initializes (first touch)
+/// its own array of total / threads bytes, hence its memory is
+/// placed on the thread's local NUMA node.
+/// Shared: all threads count chunks of a single array of total
+/// bytes which has been initialized by the main thread.
+/// Chunks are at least 8 bytes, hence the arrays are larger
+/// than total if total < 8 * threads.
+double run_threads(uint64_t (*func)(const uint8_t*, uint64_t),
+                   int threads,
+                   bool shared,
+                   uint64_t total,
+                   const std::vector<int>& cpus,
+                   double seconds)
+{
+  uint64_t chunk = std::max(total / threads, (uint64_t) 8);
+  std::vector<uint8_t> shared_vect;
+  std::vector<uint64_t> bytes(threads, 0);
+  std::vector<uint64_t> counts(threads, 0);
+  std::vector<std::thread> workers;
+  std::atomic<int> ready(0);
+  std::atomic<bool> start(false);
+  std::atomic<bool> stop(false);
+
+  if (shared)
+  {
+    shared_vect.resize(chunk * threads);
+    init(shared_vect);
+  }
+
+  for (int t = 0; t < threads; t++)
+  {
+    workers.push_back(std::thread([&, t]()
+    {
+      pin_thread(cpus[t % cpus.size()]);
+      std::vector<uint8_t> private_vect;
+
+      if (!shared)
+      {
+        private_vect.resize(chunk);
+        init(private_vect);
+      }
+
+      uint64_t cnt = 0;
+      uint64_t b = 0;
+      ready++;
+
+      while (!start)
+        std::this_thread::yield();
+
+      for (int pass = t; !stop; pass++)
+      {
+        if (shared)
+          cnt += func(&shared_vect[(pass % threads) * chunk], chunk);
+        else
+          cnt += func(&private_vect[0], chunk);
+        b += chunk;
+      }
+
+      bytes[t] = b;
+      counts[t] = cnt;
+    }));
+  }
+
+  while (ready < threads)
+    std::this_thread::yield();
+
+  double time = get_seconds();
+  start = true;
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  stop = true;
+
+  for (std::thread& worker : workers)
+    worker.join();
+
+  time = get_seconds() - time;
+  double sum = 0;
+  uint64_t cnt = 0;
+  for (int t = 0; t < threads; t++)
+  {
+    sum += (double) bytes[t];
+    cnt += counts[t];
+  }
+
+  // Written once after join(), not by the workers
+  sink = cnt;
+
+  return sum / time / 1e9;
+}
+
+/// Measure how the throughput of popcnt() scales with the number
+/// of threads compared to the memory read bandwidth.
+void scaling(const options& opts)
+{
+  std::vector<int> cpus = get_cpus();
+  uint64_t total = opts.sizes.empty() ? (1ull << 30) : opts.sizes[0];
+  const double seconds = 0.5;
+  std::vector<int> counts;
+
+  for (int t = 1; t < opts.threads; t *= 2)
+    counts.push_back(t);
+  counts.push_back(opts.threads);
+
+  std::cout << "CPU: " << get_cpu_model() << std::endl;
+  std::cout << "Array size: " << format_size(total) << " (shared), " << format_size(total) << " / threads (private)" << std::endl;
+#if defined(BENCHMARK_HAVE_AFFINITY)
+  std::cout << "Threads are pinned to CPUs: " << cpus.size() << " available" << std::endl;
+#else
+  std::cout << "Threads are not pinned" << std::endl;
+#endif
+  std::cout << std::endl;
+  std::cout << std::left << std::setw(9) << "Threads"
+            << std::setw(9) << "Memory"
+            << std::right
+            << std::setw(13) << "popcnt GB/s"
+            << std::setw(12) << "Read GB/s"
+            << std::setw(14) << "popcnt/Read"
+            << std::setw(12) << "Efficiency"
+            << std::endl;
+
+  for (int mode = 0; mode < 2; mode++)
+  {
+    bool shared = (mode == 1);
+    double single = 0;
+
+    for (int threads : counts)
+    {
+      double gbs = run_threads(popcnt_dispatch, threads, shared, total, cpus, seconds);
+      double read_gbs = run_threads(read_words, threads, shared, total, cpus, seconds);
+
+      if (threads == 1)
+        single = gbs;
+
+      // Efficiency: throughput per thread relative to 1 thread
+      std::cout << std::left << std::setw(9) << threads
+                << std::setw(9) << (shared ? "shared" : "private")
+                << std::right << std::fixed << std::setprecision(2)
+                << std::setw(13) << gbs
+                << std::setw(12) << read_gbs
+                << std::setprecision(1)
+                << std::setw(13) << gbs / read_gbs * 100 << "%"
+                << std::setw(11) << gbs / (single * threads) * 100 << "%"
+                << std::endl;
+    }
+  }
 }
 
 // count 1 bits inside vector
@@ -64,29 +1425,16 @@ void verify(uint64_t cnt, uint64_t total, int iters)
   }
 }
 
-int main(int argc, char* argv[])
+/// Benchmark a single array size using popcnt()
+void single(int bytes, int iters)
 {
-  int bytes = (1 << 10) * 16;
-  int iters = 10000000;
-
-  if (argc > 1)
-    bytes = std::atoi(argv[1]);
-  if (argc > 2)
-    iters = std::atoi(argv[2]);
-
   uint64_t cnt = 0;
   std::vector<uint8_t> vect(bytes);
   std::string algo;
   init(vect);
 
   std::cout << "Iters: " << iters << std::endl;
-
-  if (bytes < 1024)
-    std::cout << "Array size: " << bytes << " bytes" << std::endl;
-  else if (bytes < 1024 * 1024)
-    std::cout << "Array size: " << std::fixed << std::setprecision(2) << bytes / 1024.0 << " KB" << std::endl;
-  else
-    std::cout << "Array size: " << std::fixed << std::setprecision(2) << bytes / (1024.0 * 1024.0) << " MB" << std::endl;
+  std::cout << "Array size: " << format_size(bytes) << std::endl;
 
 #if defined(LIBPOPCNT_X86_OR_X64)
 
@@ -148,6 +1496,138 @@ int main(int argc, char* argv[])
 
   std::cout << std::fixed << std::setprecision(1) << GBs << " GB/s" << std::endl;
   verify(cnt, total, iters);
+}
+
+/// Parse a comma separated list e.g. "8,64,4096"
+std::vector<std::string> split(const std::string& str)
+{
+  std::vector<std::string> list;
+  std::istringstream iss(str);
+  std::string item;
+
+  while (std::getline(iss, item, ','))
+    if (!item.empty())
+      list.push_back(item);
+
+  return list;
+}
+
+void usage()
+{
+  std::cout << "Usage: ./benchmark [options]" << std::endl;
+  std::cout << "       ./benchmark [array bytes] [iters]" << std::endl;
+  std::cout << std::endl;
+  std::cout << "Options:" << std::endl;
+  std::cout << "  --sizes=LIST       Array sizes in bytes, e.g. 64,4096" << std::endl;
+  std::cout << "  --max-size=BYTES   Sweep sizes 8 bytes .. BYTES (default 256 MiB)" << std::endl;
+  std::cout << "  --align=N|all      Offset from a page boundary, all = 0..63" << std::endl;
+  std::cout << "  --kernels=LIST     Kernels, e.g. popcnt,AVX2" << std::endl;
+  std::cout << "  --reps=N           Measured repetitions (default 11)" << std::endl;
+  std::cout << "  --rep-ms=MS        Minimum milliseconds per repetition (default 2)" << std::endl;
+  std::cout << "  --perf             Measure IPC, GHz and cache misses using perf_event_open" << std::endl;
+  std::cout << "  --latency[=MIN-MAX] ns per call for random sizes (default 8-128 bytes)" << std::endl;
+  std::cout << "  --threads[=N]      Throughput scaling using 1 .. N pinned threads" << std::endl;
+  std::cout << "  --format=FORMAT    text, json or csv (default text)" << std::endl;
+  std::cout << "  --output=FILE      Write the JSON or CSV results to FILE" << std::endl;
+  std::cout << "  --compare A B      Compare two JSON or CSV result files, exits" << std::endl;
+  std::cout << "                     with 1 if the results of B are slower" << std::endl;
+  std::cout << "  --threshold=PCT    Minimum slowdown for --compare (default 5%)" << std::endl;
+  std::exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+  options opts;
+  std::vector<std::string> args;
+  std::vector<std::string> compare_files;
+
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    std::string value;
+    size_t eq = arg.find('=');
+
+    if (arg.compare(0, 2, "--") != 0)
+    {
+      args.push_back(arg);
+      continue;
+    }
+
+    if (eq != std::string::npos)
+      value = arg.substr(eq + 1);
+    arg = arg.substr(0, eq);
+
+    if (arg == "--sizes")
+      for (const std::string& s : split(value))
+        opts.sizes.push_back(std::strtoull(s.c_str(), NULL, 10));
+    else if (arg == "--max-size")
+      opts.max_size = std::strtoull(value.c_str(), NULL, 10);
+    else if (arg == "--align" && value == "all")
+      for (uint64_t align = 0; align < 64; align++)
+        opts.aligns.push_back(align);
+    else if (arg == "--align")
+      opts.aligns.push_back(std::strtoull(value.c_str(), NULL, 10));
+    else if (arg == "--kernels")
+      opts.kernels = split(value);
+    else if (arg == "--reps")
+      opts.reps = std::max(1, std::atoi(value.c_str()));
+    else if (arg == "--rep-ms")
+      opts.rep_seconds = std::atof(value.c_str()) / 1000;
+    else if (arg == "--format" && (value == "text" || value == "json" || value == "csv"))
+      opts.format = value;
+    else if (arg == "--latency")
+    {
+      size_t dash = value.find('-');
+      opts.latency_min = 8;
+      opts.latency_max = 128;
+      if (dash != std::string::npos)
+      {
+        opts.latency_min = std::strtoull(value.substr(0, dash).c_str(), NULL, 10);
+        opts.latency_max = std::strtoull(value.substr(dash + 1).c_str(), NULL, 10);
+      }
+    }
+    else if (arg == "--threads")
+      opts.threads = value.empty() ? (int) get_cpus().size() : std::max(1, std::atoi(value.c_str()));
+    else if (arg == "--perf")
+      opts.perf = true;
+    else if (arg == "--output")
+      opts.output = value;
+    else if (arg == "--threshold")
+      opts.threshold = std::atof(value.c_str());
+    else if (arg == "--compare" && i + 2 < argc)
+    {
+      compare_files.push_back(argv[++i]);
+      compare_files.push_back(argv[++i]);
+    }
+    else
+      usage();
+  }
+
+  if (opts.aligns.empty())
+    opts.aligns.push_back(0);
+
+  if (!compare_files.empty())
+    return compare(compare_files[0], compare_files[1], opts) ? 1 : 0;
+
+  // JSON and CSV results are written to --output=FILE
+  if (!opts.output.empty() && opts.format == "text")
+    opts.format = (opts.output.find(".csv") != std::string::npos) ? "csv" : "json";
+
+  // Backwards compatible: ./benchmark [array bytes] [iters]
+  if (!args.empty())
+  {
+    int bytes = std::atoi(args[0].c_str());
+    int iters = (args.size() > 1) ? std::atoi(args[1].c_str()) : 10000000;
+    single(bytes, iters);
+    return 0;
+  }
+
+  if (opts.threads > 0)
+    scaling(opts);
+  else if (opts.latency_max > 0)
+    latency(opts);
+  else
+    sweep(opts);
 
   return 0;
 }
@@ -33,6 +33,12 @@
 #define LIBPOPCNT_H
 
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_OPENMP)
+  #include <omp.h>
+#endif
 
 #ifndef __has_builtin
   #define __has_builtin(x) 0
@@ -65,6 +71,13 @@
   #define inline __inline
 #endif
 
+/* Inline into callers that pass compile time constants */
+#if __has_attribute(always_inline)
+  #define LIBPOPCNT_ALWAYS_INLINE __attribute__ ((always_inline))
+#else
+  #define LIBPOPCNT_ALWAYS_INLINE
+#endif
+
 #if (defined(__i386__) || \
      defined(__x86_64__) || \
      defined(_M_IX86) || \
@@ -150,7 +163,11 @@
    (defined(__cplusplus) || \
     defined(_MSC_VER) || \
    (LIBPOPCNT_GNUC_PREREQ(4, 2) || \
-    __has_builtin(__sync_val_compare_and_swap))) && \
+    __has_builtin(__sync_val_compare_and_swap)))
+  #define LIBPOPCNT_HAVE_RUN_CPUID
+#endif
+
+#if defined(LIBPOPCNT_HAVE_RUN_CPUID) && \
    ((defined(LIBPOPCNT_HAVE_AVX512) && !(defined(__AVX512__) || \
                                         (defined(__AVX512F__) && \
                                          defined(__AVX512BW__) && \
@@ -160,6 +177,28 @@
   #define LIBPOPCNT_HAVE_CPUID
 #endif
 
+/*
+ * If LIBPOPCNT_USDT is defined, popcnt() and the batch functions
+ * contain SystemTap compatible USDT probes (provider libpopcnt)
+ * that can be traced using bpftrace, perf or stap. A probe
+ * compiles to a single nop while it is not being traced.
+ * <sys/sdt.h> must be included outside of extern "C".
+ */
+#if defined(LIBPOPCNT_USDT) && \
+    defined(__linux__) && \
+    __has_include(<sys/sdt.h>)
+  #include <sys/sdt.h>
+  #define LIBPOPCNT_HAVE_USDT
+#endif
+
+#if defined(LIBPOPCNT_HAVE_USDT)
+  #define LIBPOPCNT_PROBE1(name, a) DTRACE_PROBE1(libpopcnt, name, a)
+  #define LIBPOPCNT_PROBE2(name, a, b) DTRACE_PROBE2(libpopcnt, name, a, b)
+#else
+  #define LIBPOPCNT_PROBE1(name, a) ((void) 0)
+  #define LIBPOPCNT_PROBE2(name, a, b) ((void) 0)
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -248,18 +287,230 @@ static inline uint64_t popcnt64(uint64_t x)
 
 #endif
 
-#if defined(LIBPOPCNT_HAVE_CPUID)
+/*
+ * If LIBPOPCNT_STATS is defined, popcnt() counts the calls, the
+ * bytes and a log2 histogram of the array sizes for each kernel.
+ * Each thread updates its own counters without locking, these are
+ * summed up by popcnt_stats_snapshot(). If LIBPOPCNT_STATS is not
+ * defined this compiles to nothing.
+ */
+#define LIBPOPCNT_KERNEL_INTEGER 0
+#define LIBPOPCNT_KERNEL_POPCNT  1
+#define LIBPOPCNT_KERNEL_AVX2    2
+#define LIBPOPCNT_KERNEL_AVX512  3
+#define LIBPOPCNT_KERNEL_NEON    4
+#define LIBPOPCNT_KERNEL_SVE     5
+#define LIBPOPCNT_KERNELS        6
+
+#if defined(LIBPOPCNT_STATS)
 
 #if defined(_MSC_VER)
   #include <intrin.h>
-  #include <immintrin.h>
 #endif
 
+typedef struct
+{
+  uint64_t calls[LIBPOPCNT_KERNELS];
+  uint64_t bytes[LIBPOPCNT_KERNELS];
+  /* histogram[k][0]: size 0, histogram[k][b]: 2^(b-1) <= size < 2^b */
+  uint64_t histogram[LIBPOPCNT_KERNELS][65];
+} libpopcnt_stats;
+
+typedef struct libpopcnt_stats_block
+{
+  libpopcnt_stats stats;
+  struct libpopcnt_stats_block* next;
+} libpopcnt_stats_block;
+
+/* The blocks of all threads, the block of the current thread and
+ * the snapshot of the last reset are shared by all translation
+ * units (weak symbols). On Windows the block of the current thread
+ * is only shared using C++17 inline variables, otherwise each
+ * translation unit registers its own block for each thread. The
+ * blocks are never freed, so the counts of exited threads remain.
+ * Programs that create many short-lived threads therefore use
+ * about 3 KiB of memory per thread that called popcnt(). */
+#if defined(_WIN32)
+  #define LIBPOPCNT_SHARED __declspec(selectany)
+  #if defined(__cpp_inline_variables)
+    #define LIBPOPCNT_SHARED_TLS inline
+  #else
+    #define LIBPOPCNT_SHARED_TLS static
+  #endif
+#else
+  #define LIBPOPCNT_SHARED __attribute__ ((weak))
+  #define LIBPOPCNT_SHARED_TLS __attribute__ ((weak))
+#endif
+
+#if defined(__cplusplus) && __cplusplus >= 201103L
+  #define LIBPOPCNT_THREAD_LOCAL thread_local
+#elif defined(_MSC_VER)
+  #define LIBPOPCNT_THREAD_LOCAL __declspec(thread)
+#else
+  #define LIBPOPCNT_THREAD_LOCAL __thread
+#endif
+
+LIBPOPCNT_SHARED libpopcnt_stats_block* volatile libpopcnt_stats_head = NULL;
+LIBPOPCNT_SHARED libpopcnt_stats libpopcnt_stats_reset_ = { { 0 }, { 0 }, { { 0 } } };
+LIBPOPCNT_SHARED_TLS LIBPOPCNT_THREAD_LOCAL libpopcnt_stats_block* libpopcnt_stats_local = NULL;
+
+/*
+ * Only the owning thread updates the counters of a block, but
+ * popcnt_stats_snapshot() reads them concurrently. Hence the
+ * counters are accessed using relaxed atomic loads and stores
+ * (no read-modify-write), which are lock-free and do not tear.
+ */
+static inline uint64_t popcnt_stats_load(const uint64_t* counter)
+{
+#if defined(__ATOMIC_RELAXED)
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+  return *(const volatile uint64_t*) counter;
+#elif defined(_MSC_VER)
+  return (uint64_t) _InterlockedCompareExchange64((volatile __int64*) counter, 0, 0);
+#else
+  return *(const volatile uint64_t*) counter;
+#endif
+}
+
+static inline void popcnt_stats_inc(uint64_t* counter, uint64_t n)
+{
+  uint64_t value = popcnt_stats_load(counter) + n;
+
+#if defined(__ATOMIC_RELAXED)
+  __atomic_store_n(counter, value, __ATOMIC_RELAXED);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+  *(volatile uint64_t*) counter = value;
+#elif defined(_MSC_VER)
+  _InterlockedExchange64((volatile __int64*) counter, (__int64) value);
+#else
+  *(volatile uint64_t*) counter = value;
+#endif
+}
+
+static inline libpopcnt_stats_block* popcnt_stats_first(void)
+{
+#if defined(__ATOMIC_ACQUIRE)
+  return __atomic_load_n(&libpopcnt_stats_head, __ATOMIC_ACQUIRE);
+#else
+  return libpopcnt_stats_head;
+#endif
+}
+
+static inline libpopcnt_stats_block* popcnt_stats_register(void)
+{
+  libpopcnt_stats_block* block = (libpopcnt_stats_block*) calloc(1, sizeof(libpopcnt_stats_block));
+  if (!block)
+    return NULL;
+
+  /* Lock-free push onto the list of all threads */
+  while (1)
+  {
+    libpopcnt_stats_block* head = popcnt_stats_first();
+    block->next = head;
+
+  #if defined(_MSC_VER)
+    if (_InterlockedCompareExchangePointer((void* volatile*) &libpopcnt_stats_head, block, head) == head)
+  #else
+    if (__sync_val_compare_and_swap(&libpopcnt_stats_head, head, block) == head)
+  #endif
+      break;
+  }
+
+  libpopcnt_stats_local = block;
+  return block;
+}
+
+static inline void popcnt_stats_add(int kernel, uint64_t size)
+{
+  libpopcnt_stats_block* block = libpopcnt_stats_local;
+  int bucket = 0;
+
+  if (!block)
+  {
+    block = popcnt_stats_register();
+    if (!block)
+      return;
+  }
+
+  for (uint64_t x = size; x > 0; x >>= 1)
+    bucket++;
+
+  popcnt_stats_inc(&block->stats.calls[kernel], 1);
+  popcnt_stats_inc(&block->stats.bytes[kernel], size);
+  popcnt_stats_inc(&block->stats.histogram[kernel][bucket], 1);
+}
+
+static inline void popcnt_stats_sum(libpopcnt_stats* out)
+{
+  memset(out, 0, sizeof(*out));
+
+  for (libpopcnt_stats_block* b = popcnt_stats_first(); b; b = b->next)
+  {
+    for (int k = 0; k < LIBPOPCNT_KERNELS; k++)
+    {
+      out->calls[k] += popcnt_stats_load(&b->stats.calls[k]);
+      out->bytes[k] += popcnt_stats_load(&b->stats.bytes[k]);
+      for (int i = 0; i < 65; i++)
+        out->histogram[k][i] += popcnt_stats_load(&b->stats.histogram[k][i]);
+    }
+  }
+}
+
+/*
+ * Get the statistics of all threads since the last
+ * popcnt_stats_reset(). The counters of threads that are
+ * currently running popcnt() may be slightly out of date.
+ */
+static inline void popcnt_stats_snapshot(libpopcnt_stats* out)
+{
+  popcnt_stats_sum(out);
+
+  for (int k = 0; k < LIBPOPCNT_KERNELS; k++)
+  {
+    out->calls[k] -= libpopcnt_stats_reset_.calls[k];
+    out->bytes[k] -= libpopcnt_stats_reset_.bytes[k];
+    for (int i = 0; i < 65; i++)
+      out->histogram[k][i] -= libpopcnt_stats_reset_.histogram[k][i];
+  }
+}
+
+/*
+ * Reset the statistics, the counters of the threads are not
+ * modified, instead their current sum is subtracted by
+ * popcnt_stats_snapshot(). Must not be called concurrently
+ * with itself or with popcnt_stats_snapshot().
+ */
+static inline void popcnt_stats_reset(void)
+{
+  popcnt_stats_sum(&libpopcnt_stats_reset_);
+}
+
+/* Returns the name of the kernel e.g. "AVX2" */
+static inline const char* popcnt_stats_kernel_name(int kernel)
+{
+  static const char* names[LIBPOPCNT_KERNELS] = { "integer", "POPCNT", "AVX2", "AVX512", "NEON", "SVE" };
+  return (kernel >= 0 && kernel < LIBPOPCNT_KERNELS) ? names[kernel] : "unknown";
+}
+
+#define LIBPOPCNT_STATS_ADD(kernel, size) popcnt_stats_add(kernel, size)
+#else
+#define LIBPOPCNT_STATS_ADD(kernel, size) ((void) 0)
+#endif
+
+/* popcnt() calls this once after selecting its kernel */
+#define LIBPOPCNT_ENTRY(kernel, size) \
+  do { \
+    LIBPOPCNT_STATS_ADD(kernel, size); \
+    LIBPOPCNT_PROBE2(popcnt_entry, size, kernel); \
+  } while (0)
+
 /* CPUID bits documentation: */
 /* https://en.wikipedia.org/wiki/CPUID */
 
 /* %ebx bit flags */
 #define LIBPOPCNT_BIT_AVX2     (1 << 5)
+#define LIBPOPCNT_BIT_BMI2     (1 << 8)
 #define LIBPOPCNT_BIT_AVX512F  (1 << 16)
 #define LIBPOPCNT_BIT_AVX512BW (1 << 30)
 
@@ -272,6 +523,13 @@ static inline uint64_t popcnt64(uint64_t x)
 #define LIBPOPCNT_XSTATE_YMM (1 << 2)
 #define LIBPOPCNT_XSTATE_ZMM (7 << 5)
 
+#if defined(LIBPOPCNT_HAVE_RUN_CPUID)
+
+#if defined(_MSC_VER)
+  #include <intrin.h>
+  #include <immintrin.h>
+#endif
+
 static inline void run_cpuid(int eax, int ecx, int* abcd)
 {
 #if defined(_MSC_VER)
@@ -305,6 +563,8 @@ static inline void run_cpuid(int eax, int ecx, int* abcd)
 #endif
 }
 
+#if defined(LIBPOPCNT_HAVE_CPUID)
+
 #if defined(LIBPOPCNT_HAVE_AVX2) || \
     defined(LIBPOPCNT_HAVE_AVX512)
 
@@ -353,6 +613,9 @@ static inline int get_cpuid(void)
     if ((abcd[1] & LIBPOPCNT_BIT_AVX2) == LIBPOPCNT_BIT_AVX2)
       flags |= LIBPOPCNT_BIT_AVX2;
 
+    if ((abcd[1] & LIBPOPCNT_BIT_BMI2) == LIBPOPCNT_BIT_BMI2)
+      flags |= LIBPOPCNT_BIT_BMI2;
+
     if ((xcr0 & zmm_mask) == zmm_mask)
     {
       /* If all AVX512 features required by our popcnt_avx512() are supported */
@@ -369,546 +632,4561 @@ static inline int get_cpuid(void)
   return flags;
 }
 
-#endif /* cpuid */
-
-#if defined(LIBPOPCNT_HAVE_AVX2) && \
-    __has_include(<immintrin.h>)
+#endif /* LIBPOPCNT_HAVE_CPUID */
 
-#include <immintrin.h>
+#if defined(LIBPOPCNT_HAVE_AVX2) || \
+    defined(LIBPOPCNT_HAVE_AVX512)
 
-#if __has_attribute(target)
-  __attribute__ ((target ("avx2")))
-#endif
-static inline void CSA256(__m256i* h, __m256i* l, __m256i a, __m256i b, __m256i c)
+/*
+ * Returns the size of the largest CPU cache (usually the L3
+ * cache) in KiB or 0 if unknown. Intel CPUs report their
+ * caches using CPUID leaf 4, AMD CPUs using leaf 0x8000001D.
+ */
+static inline int get_llc_kib(void)
 {
-  __m256i u = _mm256_xor_si256(a, b);
-  *h = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(u, c));
-  *l = _mm256_xor_si256(u, c);
-}
+  int abcd[4];
+  int llc_kib = 0;
+  uint32_t leafs[2] = { 0x4, 0x8000001D };
+  uint32_t max_leafs[2];
 
-#if __has_attribute(target)
-  __attribute__ ((target ("avx2")))
-#endif
-static inline __m256i popcnt256(__m256i v)
-{
-  __m256i lookup1 = _mm256_setr_epi8(
-      4, 5, 5, 6, 5, 6, 6, 7,
-      5, 6, 6, 7, 6, 7, 7, 8,
-      4, 5, 5, 6, 5, 6, 6, 7,
-      5, 6, 6, 7, 6, 7, 7, 8
-  );
+  run_cpuid(0, 0, abcd);
+  max_leafs[0] = (uint32_t) abcd[0];
+  run_cpuid((int) 0x80000000, 0, abcd);
+  max_leafs[1] = (uint32_t) abcd[0];
 
-  __m256i lookup2 = _mm256_setr_epi8(
-      4, 3, 3, 2, 3, 2, 2, 1,
-      3, 2, 2, 1, 2, 1, 1, 0,
-      4, 3, 3, 2, 3, 2, 2, 1,
-      3, 2, 2, 1, 2, 1, 1, 0
-  );
+  for (int i = 0; i < 2 && llc_kib == 0; i++)
+  {
+    if (max_leafs[i] < leafs[i])
+      continue;
 
-  __m256i low_mask = _mm256_set1_epi8(0x0f);
-  __m256i lo = _mm256_and_si256(v, low_mask);
-  __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
-  __m256i popcnt1 = _mm256_shuffle_epi8(lookup1, lo);
-  __m256i popcnt2 = _mm256_shuffle_epi8(lookup2, hi);
+    for (int j = 0; j < 16; j++)
+    {
+      run_cpuid((int) leafs[i], j, abcd);
+      int type = abcd[0] & 31;
+
+      /* No more caches */
+      if (type == 0)
+        break;
+      /* Skip instruction caches */
+      if (type == 2)
+        continue;
+
+      uint64_t ways = (((uint32_t) abcd[1] >> 22) & 0x3ff) + 1;
+      uint64_t partitions = (((uint32_t) abcd[1] >> 12) & 0x3ff) + 1;
+      uint64_t line_size = ((uint32_t) abcd[1] & 0xfff) + 1;
+      uint64_t sets = (uint64_t) (uint32_t) abcd[2] + 1;
+      uint64_t kib = (ways * partitions * line_size * sets) >> 10;
+
+      if (kib > (uint64_t) llc_kib && kib < (1u << 30))
+        llc_kib = (int) kib;
+    }
+  }
 
-  return _mm256_sad_epu8(popcnt1, popcnt2);
+  return llc_kib;
 }
 
 /*
- * AVX2 Harley-Seal popcount (4th iteration).
- * The algorithm is based on the paper "Faster Population Counts
- * using AVX2 Instructions" by Daniel Lemire, Nathan Kurz and
- * Wojciech Mula (23 Nov 2016).
- * @see https://arxiv.org/abs/1611.07612
+ * If LIBPOPCNT_NONTEMPORAL is defined, arrays larger than
+ * the CPU's last level cache are counted using software
+ * prefetching with the non-temporal hint. This way counting
+ * huge arrays does not evict the hot data of other threads
+ * and processes from the cache. This is not enabled by
+ * default as it reduces single thread throughput by up
+ * to 15% on some CPUs.
  */
-#if __has_attribute(target)
-  __attribute__ ((target ("avx2")))
-#endif
-static inline uint64_t popcnt_avx2(const __m256i* ptr, uint64_t size)
+static inline uint64_t get_stream_threshold(void)
 {
-  __m256i cnt = _mm256_setzero_si256();
-  __m256i ones = _mm256_setzero_si256();
-  __m256i twos = _mm256_setzero_si256();
-  __m256i fours = _mm256_setzero_si256();
-  __m256i eights = _mm256_setzero_si256();
-  __m256i sixteens = _mm256_setzero_si256();
-  __m256i twosA, twosB, foursA, foursB, eightsA, eightsB;
-
-  uint64_t i = 0;
-  uint64_t limit = size - size % 16;
-  uint64_t* cnt64;
-
-  for(; i < limit; i += 16)
+#if defined(__cplusplus)
+  /* C++11 thread-safe singleton */
+  static const int llc_kib = get_llc_kib();
+#else
+  static int llc_kib_ = -1;
+  int llc_kib = llc_kib_;
+  if (llc_kib == -1)
   {
-    CSA256(&twosA, &ones, ones, _mm256_loadu_si256(ptr + i + 0), _mm256_loadu_si256(ptr + i + 1));
-    CSA256(&twosB, &ones, ones, _mm256_loadu_si256(ptr + i + 2), _mm256_loadu_si256(ptr + i + 3));
-    CSA256(&foursA, &twos, twos, twosA, twosB);
-    CSA256(&twosA, &ones, ones, _mm256_loadu_si256(ptr + i + 4), _mm256_loadu_si256(ptr + i + 5));
-    CSA256(&twosB, &ones, ones, _mm256_loadu_si256(ptr + i + 6), _mm256_loadu_si256(ptr + i + 7));
-    CSA256(&foursB, &twos, twos, twosA, twosB);
-    CSA256(&eightsA, &fours, fours, foursA, foursB);
-    CSA256(&twosA, &ones, ones, _mm256_loadu_si256(ptr + i + 8), _mm256_loadu_si256(ptr + i + 9));
-    CSA256(&twosB, &ones, ones, _mm256_loadu_si256(ptr + i + 10), _mm256_loadu_si256(ptr + i + 11));
-    CSA256(&foursA, &twos, twos, twosA, twosB);
-    CSA256(&twosA, &ones, ones, _mm256_loadu_si256(ptr + i + 12), _mm256_loadu_si256(ptr + i + 13));
-    CSA256(&twosB, &ones, ones, _mm256_loadu_si256(ptr + i + 14), _mm256_loadu_si256(ptr + i + 15));
-    CSA256(&foursB, &twos, twos, twosA, twosB);
-    CSA256(&eightsB, &fours, fours, foursA, foursB);
-    CSA256(&sixteens, &eights, eights, eightsA, eightsB);
+    llc_kib = get_llc_kib();
 
-    cnt = _mm256_add_epi64(cnt, popcnt256(sixteens));
+    #if defined(_MSC_VER)
+      _InterlockedCompareExchange(&llc_kib_, llc_kib, -1);
+    #else
+      __sync_val_compare_and_swap(&llc_kib_, -1, llc_kib);
+    #endif
   }
+#endif
 
-  cnt = _mm256_slli_epi64(cnt, 4);
-  cnt = _mm256_add_epi64(cnt, _mm256_slli_epi64(popcnt256(eights), 3));
-  cnt = _mm256_add_epi64(cnt, _mm256_slli_epi64(popcnt256(fours), 2));
-  cnt = _mm256_add_epi64(cnt, _mm256_slli_epi64(popcnt256(twos), 1));
-  cnt = _mm256_add_epi64(cnt, popcnt256(ones));
-
-  for(; i < size; i++)
-    cnt = _mm256_add_epi64(cnt, popcnt256(_mm256_loadu_si256(ptr + i)));
-
-  cnt64 = (uint64_t*) &cnt;
+  /* Unknown cache size, assume 32 MiB */
+  if (llc_kib <= 0)
+    return 32ull << 20;
 
-  return cnt64[0] +
-         cnt64[1] +
-         cnt64[2] +
-         cnt64[3];
+  return ((uint64_t) llc_kib) << 10;
 }
 
 #endif
 
-#if defined(LIBPOPCNT_HAVE_AVX512) && \
-    __has_include(<immintrin.h>)
-
-#include <immintrin.h>
+#endif /* cpuid */
 
-#if __has_attribute(target)
-  __attribute__ ((target ("avx512f,avx512bw,avx512vpopcntdq")))
-#endif
-static inline uint64_t popcnt_avx512(const uint8_t* ptr8, uint64_t size)
+/*
+ * Returns the CPUID flags of the instruction sets supported
+ * by the CPU, CPUID is executed only once. Instruction sets
+ * enabled at compile time (e.g. using -march=native) are
+ * known without CPUID, this allows the compiler to remove
+ * the corresponding runtime checks.
+ */
+static inline int get_cpuid_flags(void)
 {
-    __m512i cnt = _mm512_setzero_si512();
-    const uint64_t* ptr64 = (const uint64_t*) ptr8;
-    uint64_t size64 = size / sizeof(uint64_t);
-    uint64_t i = 0;
+  int flags = 0;
 
-    for (; i + 32 <= size64; i += 32)
+#if defined(LIBPOPCNT_HAVE_CPUID)
+  #if defined(__cplusplus)
+    /* C++11 thread-safe singleton */
+    static const int cpuid = get_cpuid();
+  #else
+    static int cpuid_ = -1;
+    int cpuid = cpuid_;
+    if (cpuid == -1)
     {
-      __m512i vec0 = _mm512_loadu_epi64(&ptr64[i + 0]);
-      __m512i vec1 = _mm512_loadu_epi64(&ptr64[i + 8]);
-      __m512i vec2 = _mm512_loadu_epi64(&ptr64[i + 16]);
-      __m512i vec3 = _mm512_loadu_epi64(&ptr64[i + 24]);
-
-      vec0 = _mm512_popcnt_epi64(vec0);
-      vec1 = _mm512_popcnt_epi64(vec1);
-      vec2 = _mm512_popcnt_epi64(vec2);
-      vec3 = _mm512_popcnt_epi64(vec3);
+      cpuid = get_cpuid();
 
-      cnt = _mm512_add_epi64(cnt, vec0);
-      cnt = _mm512_add_epi64(cnt, vec1);
-      cnt = _mm512_add_epi64(cnt, vec2);
-      cnt = _mm512_add_epi64(cnt, vec3);
+      #if defined(_MSC_VER)
+        _InterlockedCompareExchange(&cpuid_, cpuid, -1);
+      #else
+        __sync_val_compare_and_swap(&cpuid_, -1, cpuid);
+      #endif
     }
+  #endif
 
-    for (; i + 8 <= size64; i += 8)
-    {
-      __m512i vec = _mm512_loadu_epi64(&ptr64[i]);
-      vec = _mm512_popcnt_epi64(vec);
-      cnt = _mm512_add_epi64(cnt, vec);
-    }
+  flags |= cpuid;
+#endif
 
-    i *= sizeof(uint64_t);
+#if defined(LIBPOPCNT_HAVE_POPCNT) && \
+    defined(__POPCNT__)
+  flags |= LIBPOPCNT_BIT_POPCNT;
+#endif
 
-    /* Process last 63 bytes */
-    if (i < size)
-    {
-      __mmask64 mask = (__mmask64) (0xffffffffffffffffull >> (i + 64 - size));
-      __m512i vec = _mm512_maskz_loadu_epi8(mask, &ptr8[i]);
-      vec = _mm512_popcnt_epi64(vec);
-      cnt = _mm512_add_epi64(cnt, vec);
-    }
+#if defined(LIBPOPCNT_HAVE_AVX2) && \
+    defined(__AVX2__)
+  flags |= LIBPOPCNT_BIT_AVX2;
+#endif
 
-    return _mm512_reduce_add_epi64(cnt);
+#if defined(LIBPOPCNT_HAVE_AVX2) && \
+    defined(__BMI2__)
+  flags |= LIBPOPCNT_BIT_BMI2;
+#endif
+
+#if defined(LIBPOPCNT_HAVE_AVX512) && \
+   (defined(__AVX512__) || \
+   (defined(__AVX512F__) && \
+    defined(__AVX512BW__) && \
+    defined(__AVX512VPOPCNTDQ__)))
+  flags |= LIBPOPCNT_BIT_AVX512_VPOPCNTDQ;
+#endif
+
+  return flags;
 }
 
+/*
+ * On x86 popcnt64() requires a CPU that supports POPCNT,
+ * this function falls back to popcnt64_bitwise() for
+ * CPUs without POPCNT.
+ * @cpuid: The flags returned by get_cpuid_flags()
+ */
+static inline uint64_t popcnt64_cpuid(uint64_t x, int cpuid)
+{
+#if defined(LIBPOPCNT_HAVE_POPCNT) && \
+   !defined(__POPCNT__)
+  if (!(cpuid & LIBPOPCNT_BIT_POPCNT))
+    return popcnt64_bitwise(x);
+#else
+  (void) cpuid;
 #endif
 
-/* x86 CPUs */
-#if defined(LIBPOPCNT_X86_OR_X64)
+  return popcnt64(x);
+}
+
+/* Load 8 bytes from a possibly unaligned address */
+static inline uint64_t load64(const uint8_t* ptr)
+{
+  uint64_t val;
+  memcpy(&val, ptr, sizeof(val));
+  return val;
+}
+
+/* Load the last 1 to 7 bytes of an array */
+static inline uint64_t load64_partial(const uint8_t* ptr, uint64_t bytes)
+{
+  uint64_t val = 0;
+  bytes = (bytes <= 7) ? bytes : 7;
+  for (uint64_t j = 0; j < bytes; j++)
+    val |= ((uint64_t) ptr[j]) << (j * 8);
+  return val;
+}
+
+/* Count trailing zeros, x must not be 0 */
+static inline uint64_t ctz64(uint64_t x)
+{
+#if LIBPOPCNT_GNUC_PREREQ(3, 4) || \
+    __has_builtin(__builtin_ctzll)
+  return (uint64_t) __builtin_ctzll(x);
+#elif defined(_MSC_VER) && \
+      defined(_M_X64)
+  unsigned long index;
+  _BitScanForward64(&index, x);
+  return index;
+#else
+  return popcnt64_bitwise((x & (0 - x)) - 1);
+#endif
+}
 
 /*
- * Count the number of 1 bits in the data array
- * @data: An array
- * @size: Size of data in bytes
+ * Position of the k-th set bit of x (k = 0, 1, ...),
+ * requires k < popcnt(x). Skips whole bytes, then
+ * clears the remaining lower set bits.
  */
-static uint64_t popcnt(const void* data, uint64_t size)
+static inline uint64_t select64(uint64_t x, uint64_t k, int cpuid)
 {
+  uint64_t shift = 0;
+
+  for (;; shift += 8)
+  {
+    uint64_t cnt = popcnt64_cpuid((x >> shift) & 0xff, cpuid);
+    if (cnt > k)
+      break;
+    k -= cnt;
+  }
+
+  x >>= shift;
+  for (; k > 0; k--)
+    x &= x - 1;
+
+  return shift + ctz64(x);
+}
+
 /*
- * CPUID runtime checks are only enabled if this is needed.
- * E.g. CPUID is disabled when a user compiles his
- * code using -march=native on a CPU with AVX512.
+ * Store the indexes of the set bits of the bytes
+ * ptr[i], ..., ptr[size - 1] in out[pos], out[pos + 1], ...
+ * using the portable tzcnt & blsr algorithm.
+ * Returns the new position in out.
  */
-#if defined(LIBPOPCNT_HAVE_CPUID)
-  #if defined(__cplusplus)
-    /* C++11 thread-safe singleton */
-    static const int cpuid = get_cpuid();
-  #else
-    static int cpuid_ = -1;
-    int cpuid = cpuid_;
-    if (cpuid == -1)
-    {
-      cpuid = get_cpuid();
+static inline uint64_t bitmap_decode_u64(const uint8_t* ptr, uint64_t i, uint64_t size, uint64_t pos, uint32_t* out)
+{
+  for (; i < size; i += 8)
+  {
+    uint64_t bytes = (size - i < 8) ? size - i : 8;
+    uint64_t x = (bytes == 8) ? load64(&ptr[i]) : load64_partial(&ptr[i], bytes);
 
-      #if defined(_MSC_VER)
-        _InterlockedCompareExchange(&cpuid_, cpuid, -1);
-      #else
-        __sync_val_compare_and_swap(&cpuid_, -1, cpuid);
-      #endif
-    }
-  #endif
-#endif
+    for (; x != 0; x &= x - 1)
+      out[pos++] = (uint32_t) (i * 8 + ctz64(x));
+  }
 
-  const uint8_t* ptr = (const uint8_t*) data;
+  return pos;
+}
+
+/* Bitwise operations of the fused algorithms */
+#define LIBPOPCNT_OP_XOR 0
+#define LIBPOPCNT_OP_AND 1
+#define LIBPOPCNT_OP_OR  2
+
+static inline uint64_t combine64(uint64_t a, uint64_t b, int op)
+{
+  if (op == LIBPOPCNT_OP_XOR)
+    return a ^ b;
+  if (op == LIBPOPCNT_OP_AND)
+    return a & b;
+  return a | b;
+}
+
+/*
+ * Count the number of 1 bits in (a op b) using
+ * the portable 64-bit popcount algorithm.
+ */
+static inline uint64_t popcnt_op_u64(const uint8_t* a, const uint8_t* b, uint64_t size, int op, int cpuid)
+{
   uint64_t cnt = 0;
   uint64_t i = 0;
 
-#if defined(LIBPOPCNT_HAVE_AVX512)
-  #if defined(__AVX512__) || \
-     (defined(__AVX512F__) && \
-      defined(__AVX512BW__) && \
-      defined(__AVX512VPOPCNTDQ__))
-    /* For tiny arrays AVX512 is not worth it */
-    if (i + 40 <= size)
-  #else
-    if ((cpuid & LIBPOPCNT_BIT_AVX512_VPOPCNTDQ) &&
-        i + 40 <= size)
-  #endif
-      return popcnt_avx512(ptr, size);
-#endif
+  for (; i + 8 <= size; i += 8)
+    cnt += popcnt64_cpuid(combine64(load64(&a[i]), load64(&b[i]), op), cpuid);
 
-#if defined(LIBPOPCNT_HAVE_AVX2)
-  #if defined(__AVX2__)
-    /* AVX2 requires arrays >= 512 bytes */
-    if (i + 512 <= size)
-  #else
-    if ((cpuid & LIBPOPCNT_BIT_AVX2) &&
-        i + 512 <= size)
-  #endif
+  if (i < size)
+    cnt += popcnt64_cpuid(combine64(load64_partial(&a[i], size - i),
+                                    load64_partial(&b[i], size - i), op), cpuid);
+
+  return cnt;
+}
+
+/*
+ * Count the number of 1 bits in (ptrs[0] op ... op ptrs[k - 1])
+ * starting at byte offset i using the portable 64-bit
+ * popcount algorithm.
+ */
+static inline uint64_t popcnt_many_u64(const void* const* ptrs, int k, uint64_t i, uint64_t size, int op, int cpuid)
+{
+  uint64_t cnt = 0;
+
+  for (; i + 8 <= size; i += 8)
+  {
+    uint64_t x = load64((const uint8_t*) ptrs[0] + i);
+    for (int j = 1; j < k; j++)
+      x = combine64(x, load64((const uint8_t*) ptrs[j] + i), op);
+    cnt += popcnt64_cpuid(x, cpuid);
+  }
+
+  if (i < size)
+  {
+    uint64_t x = load64_partial((const uint8_t*) ptrs[0] + i, size - i);
+    for (int j = 1; j < k; j++)
+      x = combine64(x, load64_partial((const uint8_t*) ptrs[j] + i, size - i), op);
+    cnt += popcnt64_cpuid(x, cpuid);
+  }
+
+  return cnt;
+}
+
+/*
+ * Bit-sliced vertical counters: for each bit position of the
+ * bitmaps ptrs[0], ..., ptrs[n - 1] count how many bitmaps have
+ * that bit set. The inputs are added using carry-save adders,
+ * 2 inputs of weight 2^l are merged into the counter plane l
+ * and a carry of weight 2^(l + 1), like a binary counter.
+ * @planes: If not NULL, bit j of the count is stored in
+ *          planes[j * size + i]
+ * @m: If m > 0, the bits whose count is >= m are counted
+ *     and stored in out (if not NULL)
+ */
+static inline uint64_t popcnt_vertical_u64(const void* const* ptrs,
+                                           int n,
+                                           int planes_n,
+                                           uint64_t i,
+                                           uint64_t size,
+                                           uint8_t* planes,
+                                           int m,
+                                           uint8_t* out,
+                                           int cpuid)
+{
+  uint64_t cnt = 0;
+
+  for (; i < size; i += 8)
+  {
+    uint64_t bytes = (size - i < 8) ? size - i : 8;
+    uint64_t p[32];
+    uint64_t pending[32];
+    uint32_t mask = 0;
+
+    for (int b = 0; b < planes_n; b++)
+      p[b] = 0;
+
+    for (int k = 0; k < n; k++)
     {
-      const __m256i* ptr256 = (const __m256i*)(ptr + i);
-      cnt += popcnt_avx2(ptr256, (size - i) / 32);
-      i = size - size % 32;
+      const uint8_t* ptr = (const uint8_t*) ptrs[k] + i;
+      uint64_t x = (bytes == 8) ? load64(ptr) : load64_partial(ptr, bytes);
+      int l = 0;
+
+      for (; mask & (1u << l); l++)
+      {
+        uint64_t u = p[l] ^ pending[l];
+        uint64_t carry = (p[l] & pending[l]) | (u & x);
+        p[l] = u ^ x;
+        x = carry;
+      }
+
+      mask = (mask & ~((1u << l) - 1)) | (1u << l);
+      pending[l] = x;
     }
-#endif
 
-#if defined(LIBPOPCNT_HAVE_POPCNT)
-  /* 
-   * The user has compiled without -mpopcnt.
-   * Unfortunately the MSVC compiler does not have
-   * a POPCNT macro so we cannot get rid of the
-   * runtime check for MSVC.
-   */
-  #if !defined(__POPCNT__)
-    if (cpuid & LIBPOPCNT_BIT_POPCNT)
-  #endif
+    /* Add the remaining inputs using half adders */
+    for (int l = 0; l < planes_n; l++)
     {
-      if (i + 8 <= size)
+      if (mask & (1u << l))
       {
-        uintptr_t rem = ((uintptr_t) &ptr[i]) % 8;
-
-        /* Align &ptr[i] to an 8 byte boundary */
-        if (rem != 0)
+        uint64_t x = pending[l];
+        for (int b = l; b < planes_n && x; b++)
         {
-          uint64_t val = 0;
-          uint64_t bytes = (uint64_t) (8 - rem % 8);
-          bytes = (bytes <= 7) ? bytes : 7;
-          for (uint64_t j = 0; j < bytes; j++)
-            val |= ((uint64_t) ptr[i + j]) << (j * 8);
-          cnt += popcnt64(val);
-          i += bytes;
+          uint64_t carry = p[b] & x;
+          p[b] ^= x;
+          x = carry;
         }
       }
+    }
 
-      for (; i + 8 <= size; i += 8)
-        cnt += popcnt64(*(const uint64_t*)(ptr + i));
+    if (planes)
+    {
+      for (int b = 0; b < planes_n; b++)
+        memcpy(&planes[b * size + i], &p[b], bytes);
+    }
 
-      if (i < size)
+    if (m > 0)
+    {
+      /* count >= m, compare from the most significant plane */
+      uint64_t gt = 0;
+      uint64_t eq = ~0ull;
+
+      for (int b = planes_n - 1; b >= 0; b--)
       {
-        uint64_t val = 0;
-        uint64_t bytes = (uint64_t) (size - i);
-        bytes = (bytes <= 7) ? bytes : 7;
-        for (uint64_t j = 0; j < bytes; j++)
-          val |= ((uint64_t) ptr[i + j]) << (j * 8);
-        cnt += popcnt64(val);
+        if ((m >> b) & 1)
+          eq &= p[b];
+        else
+        {
+          gt |= eq & p[b];
+          eq &= ~p[b];
+        }
       }
 
-      return cnt;
+      uint64_t ge = gt | eq;
+      cnt += popcnt64_cpuid(ge, cpuid);
+      if (out)
+        memcpy(&out[i], &ge, bytes);
     }
-#endif
+  }
+
+  return cnt;
+}
+
+/* Returns 1 if (dist1, index1) < (dist2, index2) */
+static inline int topk_less(uint64_t dist1, uint64_t index1, uint64_t dist2, uint64_t index2)
+{
+  return dist1 < dist2 || (dist1 == dist2 && index1 < index2);
+}
 
 /*
- * This code is used for:
- * 1) Compiler does not support POPCNT.
- * 2) x86 CPU does not support POPCNT (cpuid != POPCNT).
+ * Move (index, dist) down from pos to its
+ * position in the max-heap of the given size.
  */
-#if !defined(LIBPOPCNT_HAVE_POPCNT) || \
-    !defined(__POPCNT__)
+static inline void topk_sift_down(uint64_t* indexes,
+                                  uint64_t* distances,
+                                  uint64_t size,
+                                  uint64_t pos,
+                                  uint64_t index,
+                                  uint64_t dist)
+{
+  while (2 * pos + 1 < size)
+  {
+    uint64_t child = 2 * pos + 1;
 
-  if (i + 8 <= size)
+    if (child + 1 < size &&
+        topk_less(distances[child], indexes[child], distances[child + 1], indexes[child + 1]))
+      child++;
+    if (!topk_less(dist, index, distances[child], indexes[child]))
+      break;
+
+    indexes[pos] = indexes[child];
+    distances[pos] = distances[child];
+    pos = child;
+  }
+
+  indexes[pos] = index;
+  distances[pos] = dist;
+}
+
+/*
+ * Insert (index, dist) into the max-heap of the k nearest
+ * fingerprints found so far. Ties are broken by index, this
+ * way the result does not depend on the scan order.
+ */
+static inline void topk_push(uint64_t* indexes,
+                             uint64_t* distances,
+                             uint64_t* count,
+                             uint64_t k,
+                             uint64_t index,
+                             uint64_t dist)
+{
+  if (*count < k)
   {
-    uintptr_t rem = ((uintptr_t) &ptr[i]) % 8;
+    uint64_t pos = (*count)++;
 
-    /* Align &ptr[i] to an 8 byte boundary */
-    if (rem != 0)
+    while (pos > 0)
     {
-      uint64_t val = 0;
-      uint64_t bytes = (uint64_t) (8 - rem % 8);
-      bytes = (bytes <= 7) ? bytes : 7;
-      for (uint64_t j = 0; j < bytes; j++)
-        val |= ((uint64_t) ptr[i + j]) << (j * 8);
-      cnt += popcnt64_bitwise(val);
-      i += bytes;
+      uint64_t parent = (pos - 1) / 2;
+      if (!topk_less(distances[parent], indexes[parent], dist, index))
+        break;
+      indexes[pos] = indexes[parent];
+      distances[pos] = distances[parent];
+      pos = parent;
     }
-  }
 
-  for (; i + 8 <= size; i += 8)
-    cnt += popcnt64_bitwise(*(const uint64_t*)(ptr + i));
+    indexes[pos] = index;
+    distances[pos] = dist;
+  }
+  else if (topk_less(dist, index, distances[0], indexes[0]))
+    topk_sift_down(indexes, distances, k, 0, index, dist);
+}
 
-  if (i < size)
+/* Sort the max-heap in ascending order */
+static inline void topk_sort(uint64_t* indexes, uint64_t* distances, uint64_t count)
+{
+  for (uint64_t end = count; end > 1; end--)
   {
-    uint64_t val = 0;
-    uint64_t bytes = (uint64_t) (size - i);
-    bytes = (bytes <= 7) ? bytes : 7;
-    for (uint64_t j = 0; j < bytes; j++)
-      val |= ((uint64_t) ptr[i + j]) << (j * 8);
-    cnt += popcnt64_bitwise(val);
+    uint64_t index = indexes[end - 1];
+    uint64_t dist = distances[end - 1];
+    indexes[end - 1] = indexes[0];
+    distances[end - 1] = distances[0];
+    topk_sift_down(indexes, distances, end - 1, 0, index, dist);
+  }
+}
+
+/* Prefetch distance in bytes of the streaming algorithms */
+#if !defined(LIBPOPCNT_PREFETCH_DISTANCE)
+  #define LIBPOPCNT_PREFETCH_DISTANCE 1024
+#endif
+
+#if defined(LIBPOPCNT_HAVE_AVX2) && \
+    __has_include(<immintrin.h>)
+
+#include <immintrin.h>
+
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline void CSA256(__m256i* h, __m256i* l, __m256i a, __m256i b, __m256i c)
+{
+  __m256i u = _mm256_xor_si256(a, b);
+  *h = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(u, c));
+  *l = _mm256_xor_si256(u, c);
+}
+
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline __m256i popcnt256(__m256i v)
+{
+  __m256i lookup1 = _mm256_setr_epi8(
+      4, 5, 5, 6, 5, 6, 6, 7,
+      5, 6, 6, 7, 6, 7, 7, 8,
+      4, 5, 5, 6, 5, 6, 6, 7,
+      5, 6, 6, 7, 6, 7, 7, 8
+  );
+
+  __m256i lookup2 = _mm256_setr_epi8(
+      4, 3, 3, 2, 3, 2, 2, 1,
+      3, 2, 2, 1, 2, 1, 1, 0,
+      4, 3, 3, 2, 3, 2, 2, 1,
+      3, 2, 2, 1, 2, 1, 1, 0
+  );
+
+  __m256i low_mask = _mm256_set1_epi8(0x0f);
+  __m256i lo = _mm256_and_si256(v, low_mask);
+  __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+  __m256i popcnt1 = _mm256_shuffle_epi8(lookup1, lo);
+  __m256i popcnt2 = _mm256_shuffle_epi8(lookup2, hi);
+
+  return _mm256_sad_epu8(popcnt1, popcnt2);
+}
+
+/*
+ * AVX2 Harley-Seal popcount (4th iteration).
+ * The algorithm is based on the paper "Faster Population Counts
+ * using AVX2 Instructions" by Daniel Lemire, Nathan Kurz and
+ * Wojciech Mula (23 Nov 2016).
+ * @see https://arxiv.org/abs/1611.07612
+ *
+ * If stream is 1 the data is prefetched using the non-temporal
+ * hint, for arrays that do not fit into the CPU's last level
+ * cache. Inlined into popcnt_avx2() and popcnt_avx2_stream().
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+LIBPOPCNT_ALWAYS_INLINE
+static inline uint64_t harley_seal_avx2(const __m256i* ptr, uint64_t size, int stream)
+{
+  __m256i cnt = _mm256_setzero_si256();
+  __m256i ones = _mm256_setzero_si256();
+  __m256i twos = _mm256_setzero_si256();
+  __m256i fours = _mm256_setzero_si256();
+  __m256i eights = _mm256_setzero_si256();
+  __m256i sixteens = _mm256_setzero_si256();
+  __m256i twosA, twosB, foursA, foursB, eightsA, eightsB;
+
+  uint64_t i = 0;
+  uint64_t limit = size - size % 16;
+  uint64_t distance = LIBPOPCNT_PREFETCH_DISTANCE / sizeof(__m256i);
+  uint64_t* cnt64;
+
+  for(; i < limit; i += 16)
+  {
+    /* Prefetch one 64 byte cache line per 2 vectors */
+    if (stream && i + distance + 16 <= size)
+      for (uint64_t j = 0; j < 16; j += 2)
+        _mm_prefetch((const char*) (ptr + i + distance + j), _MM_HINT_NTA);
+
+    CSA256(&twosA, &ones, ones, _mm256_loadu_si256(ptr + i + 0), _mm256_loadu_si256(ptr + i + 1));
+    CSA256(&twosB, &ones, ones, _mm256_loadu_si256(ptr + i + 2), _mm256_loadu_si256(ptr + i + 3));
+    CSA256(&foursA, &twos, twos, twosA, twosB);
+    CSA256(&twosA, &ones, ones, _mm256_loadu_si256(ptr + i + 4), _mm256_loadu_si256(ptr + i + 5));
+    CSA256(&twosB, &ones, ones, _mm256_loadu_si256(ptr + i + 6), _mm256_loadu_si256(ptr + i + 7));
+    CSA256(&foursB, &twos, twos, twosA, twosB);
+    CSA256(&eightsA, &fours, fours, foursA, foursB);
+    CSA256(&twosA, &ones, ones, _mm256_loadu_si256(ptr + i + 8), _mm256_loadu_si256(ptr + i + 9));
+    CSA256(&twosB, &ones, ones, _mm256_loadu_si256(ptr + i + 10), _mm256_loadu_si256(ptr + i + 11));
+    CSA256(&foursA, &twos, twos, twosA, twosB);
+    CSA256(&twosA, &ones, ones, _mm256_loadu_si256(ptr + i + 12), _mm256_loadu_si256(ptr + i + 13));
+    CSA256(&twosB, &ones, ones, _mm256_loadu_si256(ptr + i + 14), _mm256_loadu_si256(ptr + i + 15));
+    CSA256(&foursB, &twos, twos, twosA, twosB);
+    CSA256(&eightsB, &fours, fours, foursA, foursB);
+    CSA256(&sixteens, &eights, eights, eightsA, eightsB);
+
+    cnt = _mm256_add_epi64(cnt, popcnt256(sixteens));
+  }
+
+  cnt = _mm256_slli_epi64(cnt, 4);
+  cnt = _mm256_add_epi64(cnt, _mm256_slli_epi64(popcnt256(eights), 3));
+  cnt = _mm256_add_epi64(cnt, _mm256_slli_epi64(popcnt256(fours), 2));
+  cnt = _mm256_add_epi64(cnt, _mm256_slli_epi64(popcnt256(twos), 1));
+  cnt = _mm256_add_epi64(cnt, popcnt256(ones));
+
+  for(; i < size; i++)
+    cnt = _mm256_add_epi64(cnt, popcnt256(_mm256_loadu_si256(ptr + i)));
+
+  cnt64 = (uint64_t*) &cnt;
+
+  return cnt64[0] +
+         cnt64[1] +
+         cnt64[2] +
+         cnt64[3];
+}
+
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline uint64_t popcnt_avx2(const __m256i* ptr, uint64_t size)
+{
+  return harley_seal_avx2(ptr, size, 0);
+}
+
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline uint64_t popcnt_avx2_stream(const __m256i* ptr, uint64_t size)
+{
+  return harley_seal_avx2(ptr, size, 1);
+}
+
+/*
+ * State of the AVX2 Harley-Seal algorithm, used by the
+ * algorithms that count the 1 bits of a combination
+ * (e.g. XOR, AND) of multiple arrays.
+ */
+typedef struct
+{
+  __m256i cnt;
+  __m256i ones;
+  __m256i twos;
+  __m256i fours;
+  __m256i eights;
+  __m256i tail;
+} libpopcnt_hs256;
+
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline void hs256_init(libpopcnt_hs256* hs)
+{
+  hs->cnt = _mm256_setzero_si256();
+  hs->ones = _mm256_setzero_si256();
+  hs->twos = _mm256_setzero_si256();
+  hs->fours = _mm256_setzero_si256();
+  hs->eights = _mm256_setzero_si256();
+  hs->tail = _mm256_setzero_si256();
+}
+
+/* Add the 1 bits of 16 vectors to the Harley-Seal state */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline void hs256_add16(libpopcnt_hs256* hs, const __m256i* v)
+{
+  __m256i twosA, twosB, foursA, foursB, eightsA, eightsB, sixteens;
+
+  CSA256(&twosA, &hs->ones, hs->ones, v[0], v[1]);
+  CSA256(&twosB, &hs->ones, hs->ones, v[2], v[3]);
+  CSA256(&foursA, &hs->twos, hs->twos, twosA, twosB);
+  CSA256(&twosA, &hs->ones, hs->ones, v[4], v[5]);
+  CSA256(&twosB, &hs->ones, hs->ones, v[6], v[7]);
+  CSA256(&foursB, &hs->twos, hs->twos, twosA, twosB);
+  CSA256(&eightsA, &hs->fours, hs->fours, foursA, foursB);
+  CSA256(&twosA, &hs->ones, hs->ones, v[8], v[9]);
+  CSA256(&twosB, &hs->ones, hs->ones, v[10], v[11]);
+  CSA256(&foursA, &hs->twos, hs->twos, twosA, twosB);
+  CSA256(&twosA, &hs->ones, hs->ones, v[12], v[13]);
+  CSA256(&twosB, &hs->ones, hs->ones, v[14], v[15]);
+  CSA256(&foursB, &hs->twos, hs->twos, twosA, twosB);
+  CSA256(&eightsB, &hs->fours, hs->fours, foursA, foursB);
+  CSA256(&sixteens, &hs->eights, hs->eights, eightsA, eightsB);
+
+  hs->cnt = _mm256_add_epi64(hs->cnt, popcnt256(sixteens));
+}
+
+/* Add the 1 bits of a single vector to the Harley-Seal state */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline void hs256_add(libpopcnt_hs256* hs, __m256i v)
+{
+  hs->tail = _mm256_add_epi64(hs->tail, popcnt256(v));
+}
+
+/* Returns the number of 1 bits counted by the Harley-Seal state */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline uint64_t hs256_sum(const libpopcnt_hs256* hs)
+{
+  __m256i cnt = _mm256_slli_epi64(hs->cnt, 4);
+  cnt = _mm256_add_epi64(cnt, _mm256_slli_epi64(popcnt256(hs->eights), 3));
+  cnt = _mm256_add_epi64(cnt, _mm256_slli_epi64(popcnt256(hs->fours), 2));
+  cnt = _mm256_add_epi64(cnt, _mm256_slli_epi64(popcnt256(hs->twos), 1));
+  cnt = _mm256_add_epi64(cnt, popcnt256(hs->ones));
+  cnt = _mm256_add_epi64(cnt, hs->tail);
+
+  uint64_t* cnt64 = (uint64_t*) &cnt;
+
+  return cnt64[0] +
+         cnt64[1] +
+         cnt64[2] +
+         cnt64[3];
+}
+
+/* Sums of the 64-bit lanes of 4 vectors: [sum(v0), ..., sum(v3)] */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline __m256i reduce4_avx2(__m256i v0, __m256i v1, __m256i v2, __m256i v3)
+{
+  __m256i v01 = _mm256_add_epi64(_mm256_unpacklo_epi64(v0, v1), _mm256_unpackhi_epi64(v0, v1));
+  __m256i v23 = _mm256_add_epi64(_mm256_unpacklo_epi64(v2, v3), _mm256_unpackhi_epi64(v2, v3));
+
+  return _mm256_add_epi64(_mm256_permute2x128_si256(v01, v23, 0x20),
+                          _mm256_permute2x128_si256(v01, v23, 0x31));
+}
+
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline __m256i combine256(__m256i a, __m256i b, int op)
+{
+  if (op == LIBPOPCNT_OP_XOR)
+    return _mm256_xor_si256(a, b);
+  if (op == LIBPOPCNT_OP_AND)
+    return _mm256_and_si256(a, b);
+  return _mm256_or_si256(a, b);
+}
+
+/*
+ * AVX2 Harley-Seal popcount of (a op b).
+ * All CPUs with AVX2 support POPCNT, hence
+ * the last bytes are counted using popcnt64().
+ * Inlined into the kernels below, one for each op.
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+LIBPOPCNT_ALWAYS_INLINE
+static inline uint64_t popcnt_op_avx2(const uint8_t* a, const uint8_t* b, uint64_t size, int op)
+{
+  const __m256i* a256 = (const __m256i*) a;
+  const __m256i* b256 = (const __m256i*) b;
+  uint64_t size256 = size / 32;
+  uint64_t i = 0;
+  libpopcnt_hs256 hs;
+  __m256i v[16];
+
+  hs256_init(&hs);
+
+  for (; i + 16 <= size256; i += 16)
+  {
+    for (int j = 0; j < 16; j++)
+      v[j] = combine256(_mm256_loadu_si256(a256 + i + j), _mm256_loadu_si256(b256 + i + j), op);
+    hs256_add16(&hs, v);
+  }
+
+  for (; i < size256; i++)
+    hs256_add(&hs, combine256(_mm256_loadu_si256(a256 + i), _mm256_loadu_si256(b256 + i), op));
+
+  return hs256_sum(&hs) + popcnt_op_u64(&a[i * 32], &b[i * 32], size - i * 32, op, LIBPOPCNT_BIT_POPCNT);
+}
+
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline uint64_t popcnt_xor_avx2(const uint8_t* a, const uint8_t* b, uint64_t size)
+{
+  return popcnt_op_avx2(a, b, size, LIBPOPCNT_OP_XOR);
+}
+
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline uint64_t popcnt_and_avx2(const uint8_t* a, const uint8_t* b, uint64_t size)
+{
+  return popcnt_op_avx2(a, b, size, LIBPOPCNT_OP_AND);
+}
+
+/*
+ * Count the 1 bits of (query op db[r]) for the 4 arrays
+ * db[0], ..., db[3] of size bytes stored contiguously.
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline __m256i popcnt4_op_avx2(const uint8_t* query, const uint8_t* db, uint64_t size, int op)
+{
+  __m256i cnt0 = _mm256_setzero_si256();
+  __m256i cnt1 = _mm256_setzero_si256();
+  __m256i cnt2 = _mm256_setzero_si256();
+  __m256i cnt3 = _mm256_setzero_si256();
+  uint64_t limit = size - size % 32;
+  uint64_t tail[4] = { 0, 0, 0, 0 };
+
+  for (uint64_t j = 0; j < limit; j += 32)
+  {
+    __m256i q = _mm256_loadu_si256((const __m256i*) &query[j]);
+
+    __m256i vec0 = combine256(q, _mm256_loadu_si256((const __m256i*) &db[0 * size + j]), op);
+    __m256i vec1 = combine256(q, _mm256_loadu_si256((const __m256i*) &db[1 * size + j]), op);
+    __m256i vec2 = combine256(q, _mm256_loadu_si256((const __m256i*) &db[2 * size + j]), op);
+    __m256i vec3 = combine256(q, _mm256_loadu_si256((const __m256i*) &db[3 * size + j]), op);
+
+    cnt0 = _mm256_add_epi64(cnt0, popcnt256(vec0));
+    cnt1 = _mm256_add_epi64(cnt1, popcnt256(vec1));
+    cnt2 = _mm256_add_epi64(cnt2, popcnt256(vec2));
+    cnt3 = _mm256_add_epi64(cnt3, popcnt256(vec3));
+  }
+
+  if (limit < size)
+  {
+    for (uint64_t r = 0; r < 4; r++)
+      tail[r] = popcnt_op_u64(&query[limit], &db[r * size + limit], size - limit, op, LIBPOPCNT_BIT_POPCNT);
+  }
+
+  __m256i cnt = reduce4_avx2(cnt0, cnt1, cnt2, cnt3);
+  return _mm256_add_epi64(cnt, _mm256_loadu_si256((const __m256i*) tail));
+}
+
+/*
+ * Computes the Hamming distances of the query and the
+ * next 4 fingerprints. Returns a bit mask of the fingerprints
+ * whose distance is <= threshold, the distances are stored
+ * in dist[] only if the mask is not 0.
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline int hamming4_filter_avx2(const uint8_t* query,
+                                       const uint8_t* db,
+                                       uint64_t size,
+                                       uint64_t threshold,
+                                       uint64_t* dist)
+{
+  __m256i vdist = popcnt4_op_avx2(query, db, size, LIBPOPCNT_OP_XOR);
+  threshold = (threshold < (1ull << 62)) ? threshold : (1ull << 62);
+  __m256i gt = _mm256_cmpgt_epi64(vdist, _mm256_set1_epi64x((long long) threshold));
+  int mask = ~_mm256_movemask_pd(_mm256_castsi256_pd(gt)) & 0xf;
+
+  if (mask)
+    _mm256_storeu_si256((__m256i*) dist, vdist);
+
+  return mask;
+}
+
+/*
+ * Count the 1 bits of (query op db[j]) for 0 <= j < n,
+ * processes 4 arrays at once. Returns the number of
+ * processed arrays (n - n % 4).
+ * @out: out[j] = popcnt(query op db[j])
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline uint64_t popcnt_op_row_avx2(const uint8_t* query,
+                                          const uint8_t* db,
+                                          uint64_t size,
+                                          uint64_t n,
+                                          int op,
+                                          uint64_t* out)
+{
+  uint64_t j = 0;
+
+  /* Keep the op check out of the inner loop */
+  if (op == LIBPOPCNT_OP_XOR)
+    for (; j + 4 <= n; j += 4)
+      _mm256_storeu_si256((__m256i*) &out[j], popcnt4_op_avx2(query, &db[j * size], size, LIBPOPCNT_OP_XOR));
+  else if (op == LIBPOPCNT_OP_AND)
+    for (; j + 4 <= n; j += 4)
+      _mm256_storeu_si256((__m256i*) &out[j], popcnt4_op_avx2(query, &db[j * size], size, LIBPOPCNT_OP_AND));
+  else
+    for (; j + 4 <= n; j += 4)
+      _mm256_storeu_si256((__m256i*) &out[j], popcnt4_op_avx2(query, &db[j * size], size, LIBPOPCNT_OP_OR));
+
+  return j;
+}
+
+/*
+ * AVX2 popcount of n records of k * 32 bytes each.
+ * The counts of 4 records are stored using one store.
+ * Inlined into the kernels below, one for each record
+ * size, where k is a constant: the loop over the
+ * vectors of a record is fully unrolled for small
+ * records and has a constant trip count otherwise.
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+LIBPOPCNT_ALWAYS_INLINE
+static inline void popcnt_records_avx2(const uint8_t* ptr, uint64_t k, uint64_t n, uint64_t* out)
+{
+  uint64_t record_size = k * 32;
+  uint64_t i = 0;
+  uint64_t limit = n - n % 4;
+
+  for (; i < limit; i += 4)
+  {
+    const __m256i* ptr0 = (const __m256i*) &ptr[(i + 0) * record_size];
+    const __m256i* ptr1 = (const __m256i*) &ptr[(i + 1) * record_size];
+    const __m256i* ptr2 = (const __m256i*) &ptr[(i + 2) * record_size];
+    const __m256i* ptr3 = (const __m256i*) &ptr[(i + 3) * record_size];
+    __m256i cnt0 = popcnt256(_mm256_loadu_si256(ptr0));
+    __m256i cnt1 = popcnt256(_mm256_loadu_si256(ptr1));
+    __m256i cnt2 = popcnt256(_mm256_loadu_si256(ptr2));
+    __m256i cnt3 = popcnt256(_mm256_loadu_si256(ptr3));
+
+    for (uint64_t j = 1; j < k; j++)
+    {
+      cnt0 = _mm256_add_epi64(cnt0, popcnt256(_mm256_loadu_si256(ptr0 + j)));
+      cnt1 = _mm256_add_epi64(cnt1, popcnt256(_mm256_loadu_si256(ptr1 + j)));
+      cnt2 = _mm256_add_epi64(cnt2, popcnt256(_mm256_loadu_si256(ptr2 + j)));
+      cnt3 = _mm256_add_epi64(cnt3, popcnt256(_mm256_loadu_si256(ptr3 + j)));
+    }
+
+    _mm256_storeu_si256((__m256i*) &out[i], reduce4_avx2(cnt0, cnt1, cnt2, cnt3));
+  }
+
+  for (; i < n; i++)
+  {
+    const __m256i* ptr256 = (const __m256i*) &ptr[i * record_size];
+    __m256i cnt = _mm256_setzero_si256();
+
+    for (uint64_t j = 0; j < k; j++)
+      cnt = _mm256_add_epi64(cnt, popcnt256(_mm256_loadu_si256(ptr256 + j)));
+
+    uint64_t* cnt64 = (uint64_t*) &cnt;
+    out[i] = cnt64[0] + cnt64[1] + cnt64[2] + cnt64[3];
+  }
+}
+
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline void popcnt_records32_avx2(const uint8_t* ptr, uint64_t n, uint64_t* out)
+{
+  popcnt_records_avx2(ptr, 1, n, out);
+}
+
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline void popcnt_records64_avx2(const uint8_t* ptr, uint64_t n, uint64_t* out)
+{
+  popcnt_records_avx2(ptr, 2, n, out);
+}
+
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline void popcnt_records128_avx2(const uint8_t* ptr, uint64_t n, uint64_t* out)
+{
+  popcnt_records_avx2(ptr, 4, n, out);
+}
+
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline void popcnt_records256_avx2(const uint8_t* ptr, uint64_t n, uint64_t* out)
+{
+  popcnt_records_avx2(ptr, 8, n, out);
+}
+
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline void popcnt_records512_avx2(const uint8_t* ptr, uint64_t n, uint64_t* out)
+{
+  popcnt_records_avx2(ptr, 16, n, out);
+}
+
+/*
+ * Combine the 32 bytes at byte offset i of
+ * the k arrays ptrs[0], ..., ptrs[k - 1].
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline __m256i combine_many256(const void* const* ptrs, int k, uint64_t i, int op)
+{
+  __m256i vec = _mm256_loadu_si256((const __m256i*) ((const uint8_t*) ptrs[0] + i));
+
+  if (op == LIBPOPCNT_OP_XOR)
+    for (int j = 1; j < k; j++)
+      vec = _mm256_xor_si256(vec, _mm256_loadu_si256((const __m256i*) ((const uint8_t*) ptrs[j] + i)));
+  else if (op == LIBPOPCNT_OP_AND)
+    for (int j = 1; j < k; j++)
+      vec = _mm256_and_si256(vec, _mm256_loadu_si256((const __m256i*) ((const uint8_t*) ptrs[j] + i)));
+  else
+    for (int j = 1; j < k; j++)
+      vec = _mm256_or_si256(vec, _mm256_loadu_si256((const __m256i*) ((const uint8_t*) ptrs[j] + i)));
+
+  return vec;
+}
+
+/*
+ * AVX2 Harley-Seal popcount of (ptrs[0] op ... op ptrs[k - 1]).
+ * The k arrays are read only once, they are combined
+ * in registers without any temporary arrays.
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline uint64_t popcnt_many_avx2(const void* const* ptrs, int k, uint64_t size, int op)
+{
+  uint64_t i = 0;
+  libpopcnt_hs256 hs;
+  __m256i v[16];
+
+  hs256_init(&hs);
+
+  for (; i + 512 <= size; i += 512)
+  {
+    for (int j = 0; j < 16; j++)
+      v[j] = combine_many256(ptrs, k, i + j * 32, op);
+    hs256_add16(&hs, v);
+  }
+
+  for (; i + 32 <= size; i += 32)
+    hs256_add(&hs, combine_many256(ptrs, k, i, op));
+
+  return hs256_sum(&hs) + popcnt_many_u64(ptrs, k, i, size, op, LIBPOPCNT_BIT_POPCNT);
+}
+
+/* AVX2 version of popcnt_vertical_u64(), processes 32 bytes at once */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline uint64_t popcnt_vertical_avx2(const void* const* ptrs,
+                                            int n,
+                                            int planes_n,
+                                            uint64_t limit,
+                                            uint64_t size,
+                                            uint8_t* planes,
+                                            int m,
+                                            uint8_t* out)
+{
+  __m256i cnt = _mm256_setzero_si256();
+
+  for (uint64_t i = 0; i < limit; i += 32)
+  {
+    __m256i p[32];
+    __m256i pending[32];
+    uint32_t mask = 0;
+
+    for (int b = 0; b < planes_n; b++)
+      p[b] = _mm256_setzero_si256();
+
+    for (int k = 0; k < n; k++)
+    {
+      __m256i x = _mm256_loadu_si256((const __m256i*) ((const uint8_t*) ptrs[k] + i));
+      int l = 0;
+
+      for (; mask & (1u << l); l++)
+        CSA256(&x, &p[l], p[l], pending[l], x);
+
+      mask = (mask & ~((1u << l) - 1)) | (1u << l);
+      pending[l] = x;
+    }
+
+    /* Add the remaining inputs using half adders */
+    for (int l = 0; l < planes_n; l++)
+    {
+      if (mask & (1u << l))
+      {
+        __m256i x = pending[l];
+        for (int b = l; b < planes_n; b++)
+        {
+          __m256i carry = _mm256_and_si256(p[b], x);
+          p[b] = _mm256_xor_si256(p[b], x);
+          x = carry;
+        }
+      }
+    }
+
+    if (planes)
+    {
+      for (int b = 0; b < planes_n; b++)
+        _mm256_storeu_si256((__m256i*) &planes[b * size + i], p[b]);
+    }
+
+    if (m > 0)
+    {
+      __m256i gt = _mm256_setzero_si256();
+      __m256i eq = _mm256_set1_epi64x(-1);
+
+      for (int b = planes_n - 1; b >= 0; b--)
+      {
+        if ((m >> b) & 1)
+          eq = _mm256_and_si256(eq, p[b]);
+        else
+        {
+          gt = _mm256_or_si256(gt, _mm256_and_si256(eq, p[b]));
+          eq = _mm256_andnot_si256(p[b], eq);
+        }
+      }
+
+      __m256i ge = _mm256_or_si256(gt, eq);
+      cnt = _mm256_add_epi64(cnt, popcnt256(ge));
+      if (out)
+        _mm256_storeu_si256((__m256i*) &out[i], ge);
+    }
+  }
+
+  uint64_t* cnt64 = (uint64_t*) &cnt;
+
+  return cnt64[0] +
+         cnt64[1] +
+         cnt64[2] +
+         cnt64[3];
+}
+
+/* x ^ (x << 1) of the 32 bytes at ptr[i], the carry bits are read from ptr[i - 8] */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline __m256i transitions256(const uint8_t* ptr, uint64_t i)
+{
+  __m256i x = _mm256_loadu_si256((const __m256i*) &ptr[i]);
+  __m256i prev = _mm256_loadu_si256((const __m256i*) &ptr[i - 8]);
+  __m256i shifted = _mm256_or_si256(_mm256_slli_epi64(x, 1), _mm256_srli_epi64(prev, 63));
+  return _mm256_xor_si256(x, shifted);
+}
+
+/*
+ * AVX2 Harley-Seal popcount of x ^ (x << 1) for the bytes
+ * ptr[i], ..., ptr[limit - 1], requires i >= 8 and
+ * (limit - i) % 32 == 0.
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline uint64_t popcnt_transitions_avx2(const uint8_t* ptr, uint64_t i, uint64_t limit)
+{
+  libpopcnt_hs256 hs;
+  __m256i v[16];
+
+  hs256_init(&hs);
+
+  for (; i + 512 <= limit; i += 512)
+  {
+    for (int j = 0; j < 16; j++)
+      v[j] = transitions256(ptr, i + j * 32);
+    hs256_add16(&hs, v);
+  }
+
+  for (; i < limit; i += 32)
+    hs256_add(&hs, transitions256(ptr, i));
+
+  return hs256_sum(&hs);
+}
+
+/*
+ * Indexes of the set bits of each byte value, packed into
+ * the bytes of a 64-bit integer (lowest index first).
+ */
+static const uint64_t libpopcnt_decode_lut[256] =
+{
+  0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000001ull, 0x0000000000000100ull,
+  0x0000000000000002ull, 0x0000000000000200ull, 0x0000000000000201ull, 0x0000000000020100ull,
+  0x0000000000000003ull, 0x0000000000000300ull, 0x0000000000000301ull, 0x0000000000030100ull,
+  0x0000000000000302ull, 0x0000000000030200ull, 0x0000000000030201ull, 0x0000000003020100ull,
+  0x0000000000000004ull, 0x0000000000000400ull, 0x0000000000000401ull, 0x0000000000040100ull,
+  0x0000000000000402ull, 0x0000000000040200ull, 0x0000000000040201ull, 0x0000000004020100ull,
+  0x0000000000000403ull, 0x0000000000040300ull, 0x0000000000040301ull, 0x0000000004030100ull,
+  0x0000000000040302ull, 0x0000000004030200ull, 0x0000000004030201ull, 0x0000000403020100ull,
+  0x0000000000000005ull, 0x0000000000000500ull, 0x0000000000000501ull, 0x0000000000050100ull,
+  0x0000000000000502ull, 0x0000000000050200ull, 0x0000000000050201ull, 0x0000000005020100ull,
+  0x0000000000000503ull, 0x0000000000050300ull, 0x0000000000050301ull, 0x0000000005030100ull,
+  0x0000000000050302ull, 0x0000000005030200ull, 0x0000000005030201ull, 0x0000000503020100ull,
+  0x0000000000000504ull, 0x0000000000050400ull, 0x0000000000050401ull, 0x0000000005040100ull,
+  0x0000000000050402ull, 0x0000000005040200ull, 0x0000000005040201ull, 0x0000000504020100ull,
+  0x0000000000050403ull, 0x0000000005040300ull, 0x0000000005040301ull, 0x0000000504030100ull,
+  0x0000000005040302ull, 0x0000000504030200ull, 0x0000000504030201ull, 0x0000050403020100ull,
+  0x0000000000000006ull, 0x0000000000000600ull, 0x0000000000000601ull, 0x0000000000060100ull,
+  0x0000000000000602ull, 0x0000000000060200ull, 0x0000000000060201ull, 0x0000000006020100ull,
+  0x0000000000000603ull, 0x0000000000060300ull, 0x0000000000060301ull, 0x0000000006030100ull,
+  0x0000000000060302ull, 0x0000000006030200ull, 0x0000000006030201ull, 0x0000000603020100ull,
+  0x0000000000000604ull, 0x0000000000060400ull, 0x0000000000060401ull, 0x0000000006040100ull,
+  0x0000000000060402ull, 0x0000000006040200ull, 0x0000000006040201ull, 0x0000000604020100ull,
+  0x0000000000060403ull, 0x0000000006040300ull, 0x0000000006040301ull, 0x0000000604030100ull,
+  0x0000000006040302ull, 0x0000000604030200ull, 0x0000000604030201ull, 0x0000060403020100ull,
+  0x0000000000000605ull, 0x0000000000060500ull, 0x0000000000060501ull, 0x0000000006050100ull,
+  0x0000000000060502ull, 0x0000000006050200ull, 0x0000000006050201ull, 0x0000000605020100ull,
+  0x0000000000060503ull, 0x0000000006050300ull, 0x0000000006050301ull, 0x0000000605030100ull,
+  0x0000000006050302ull, 0x0000000605030200ull, 0x0000000605030201ull, 0x0000060503020100ull,
+  0x0000000000060504ull, 0x0000000006050400ull, 0x0000000006050401ull, 0x0000000605040100ull,
+  0x0000000006050402ull, 0x0000000605040200ull, 0x0000000605040201ull, 0x0000060504020100ull,
+  0x0000000006050403ull, 0x0000000605040300ull, 0x0000000605040301ull, 0x0000060504030100ull,
+  0x0000000605040302ull, 0x0000060504030200ull, 0x0000060504030201ull, 0x0006050403020100ull,
+  0x0000000000000007ull, 0x0000000000000700ull, 0x0000000000000701ull, 0x0000000000070100ull,
+  0x0000000000000702ull, 0x0000000000070200ull, 0x0000000000070201ull, 0x0000000007020100ull,
+  0x0000000000000703ull, 0x0000000000070300ull, 0x0000000000070301ull, 0x0000000007030100ull,
+  0x0000000000070302ull, 0x0000000007030200ull, 0x0000000007030201ull, 0x0000000703020100ull,
+  0x0000000000000704ull, 0x0000000000070400ull, 0x0000000000070401ull, 0x0000000007040100ull,
+  0x0000000000070402ull, 0x0000000007040200ull, 0x0000000007040201ull, 0x0000000704020100ull,
+  0x0000000000070403ull, 0x0000000007040300ull, 0x0000000007040301ull, 0x0000000704030100ull,
+  0x0000000007040302ull, 0x0000000704030200ull, 0x0000000704030201ull, 0x0000070403020100ull,
+  0x0000000000000705ull, 0x0000000000070500ull, 0x0000000000070501ull, 0x0000000007050100ull,
+  0x0000000000070502ull, 0x0000000007050200ull, 0x0000000007050201ull, 0x0000000705020100ull,
+  0x0000000000070503ull, 0x0000000007050300ull, 0x0000000007050301ull, 0x0000000705030100ull,
+  0x0000000007050302ull, 0x0000000705030200ull, 0x0000000705030201ull, 0x0000070503020100ull,
+  0x0000000000070504ull, 0x0000000007050400ull, 0x0000000007050401ull, 0x0000000705040100ull,
+  0x0000000007050402ull, 0x0000000705040200ull, 0x0000000705040201ull, 0x0000070504020100ull,
+  0x0000000007050403ull, 0x0000000705040300ull, 0x0000000705040301ull, 0x0000070504030100ull,
+  0x0000000705040302ull, 0x0000070504030200ull, 0x0000070504030201ull, 0x0007050403020100ull,
+  0x0000000000000706ull, 0x0000000000070600ull, 0x0000000000070601ull, 0x0000000007060100ull,
+  0x0000000000070602ull, 0x0000000007060200ull, 0x0000000007060201ull, 0x0000000706020100ull,
+  0x0000000000070603ull, 0x0000000007060300ull, 0x0000000007060301ull, 0x0000000706030100ull,
+  0x0000000007060302ull, 0x0000000706030200ull, 0x0000000706030201ull, 0x0000070603020100ull,
+  0x0000000000070604ull, 0x0000000007060400ull, 0x0000000007060401ull, 0x0000000706040100ull,
+  0x0000000007060402ull, 0x0000000706040200ull, 0x0000000706040201ull, 0x0000070604020100ull,
+  0x0000000007060403ull, 0x0000000706040300ull, 0x0000000706040301ull, 0x0000070604030100ull,
+  0x0000000706040302ull, 0x0000070604030200ull, 0x0000070604030201ull, 0x0007060403020100ull,
+  0x0000000000070605ull, 0x0000000007060500ull, 0x0000000007060501ull, 0x0000000706050100ull,
+  0x0000000007060502ull, 0x0000000706050200ull, 0x0000000706050201ull, 0x0000070605020100ull,
+  0x0000000007060503ull, 0x0000000706050300ull, 0x0000000706050301ull, 0x0000070605030100ull,
+  0x0000000706050302ull, 0x0000070605030200ull, 0x0000070605030201ull, 0x0007060503020100ull,
+  0x0000000007060504ull, 0x0000000706050400ull, 0x0000000706050401ull, 0x0000070605040100ull,
+  0x0000000706050402ull, 0x0000070605040200ull, 0x0000070605040201ull, 0x0007060504020100ull,
+  0x0000000706050403ull, 0x0000070605040300ull, 0x0000070605040301ull, 0x0007060504030100ull,
+  0x0000070605040302ull, 0x0007060504030200ull, 0x0007060504030201ull, 0x0706050403020100ull
+};
+
+/*
+ * AVX2 bitmap decoding using a lookup table, the indexes of
+ * the set bits of each byte are stored using one 32 byte store.
+ * Each store writes 8 indexes, stops when out has fewer than
+ * 64 free entries. Returns the number of decoded words,
+ * the new position in out is stored in *pos.
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline uint64_t bitmap_decode_avx2(const uint8_t* ptr, uint64_t words, uint64_t total, uint64_t* pos, uint32_t* out)
+{
+  uint64_t i = 0;
+  uint64_t p = *pos;
+
+  for (; i < words && p + 64 <= total; i++)
+  {
+    uint64_t x = load64(&ptr[i * 8]);
+
+    /* Sparse words are faster using tzcnt & blsr */
+    if (popcnt64_cpuid(x, LIBPOPCNT_BIT_POPCNT) <= 8)
+    {
+      for (; x != 0; x &= x - 1)
+        out[p++] = (uint32_t) (i * 64 + ctz64(x));
+      continue;
+    }
+
+    for (int j = 0; j < 8; j++)
+    {
+      uint64_t byte = (x >> (j * 8)) & 0xff;
+      __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) &libpopcnt_decode_lut[byte]));
+      idx = _mm256_add_epi32(idx, _mm256_set1_epi32((int) (i * 64 + j * 8)));
+      _mm256_storeu_si256((__m256i*) &out[p], idx);
+      p += popcnt64_cpuid(byte, LIBPOPCNT_BIT_POPCNT);
+    }
+  }
+
+  *pos = p;
+  return i;
+}
+
+/* Position of the k-th set bit of x, requires k < popcnt(x) */
+#if __has_attribute(target)
+  __attribute__ ((target ("bmi,bmi2")))
+#endif
+static inline uint64_t select64_bmi2(uint64_t x, uint64_t k)
+{
+#if defined(__x86_64__) || \
+    defined(_M_X64)
+  return _tzcnt_u64(_pdep_u64(1ull << k, x));
+#else
+  /* The 64-bit BMI2 instructions require x64 */
+  uint32_t lo = (uint32_t) x;
+  uint64_t cnt = popcnt64_cpuid(lo, LIBPOPCNT_BIT_POPCNT);
+  if (k < cnt)
+    return _tzcnt_u32(_pdep_u32(1u << k, lo));
+  return 32 + _tzcnt_u32(_pdep_u32(1u << (k - cnt), (uint32_t) (x >> 32)));
+#endif
+}
+
+/*
+ * Skip the 512 byte blocks before the block that contains
+ * the k-th set bit, the blocks are counted using the
+ * Harley-Seal algorithm. Returns the offset of that block
+ * (or of the last bytes), k is updated accordingly.
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline uint64_t popcnt_select_avx2(const uint8_t* ptr, uint64_t size, uint64_t* k)
+{
+  uint64_t i = 0;
+
+  for (; i + 512 <= size; i += 512)
+  {
+    uint64_t cnt = popcnt_avx2((const __m256i*) &ptr[i], 16);
+    if (cnt > *k)
+      break;
+    *k -= cnt;
+  }
+
+  return i;
+}
+
+/*
+ * AVX2 popcount of (mask AND columns[j]) for 0 <= j < n.
+ * The bitmaps are processed in chunks of 16 KiB, for each
+ * chunk 4 columns are counted at once. Each mask vector is
+ * loaded once per 4 columns and read from memory only once
+ * as the mask chunk stays in the CPU's cache.
+ * @out: out[j] += popcnt(mask AND columns[j])
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline void popcnt_masked_avx2(const uint8_t* mask, const void* const* columns, int n, uint64_t size, uint64_t* out)
+{
+  uint64_t chunk = 16 << 10;
+  uint64_t limit = size - size % 32;
+
+  for (uint64_t first = 0; first < limit; first += chunk)
+  {
+    uint64_t last = (limit - first > chunk) ? first + chunk : limit;
+
+    for (int g = 0; g < n; g += 4)
+    {
+      /* Pad the last group with the last column */
+      const uint8_t* col0 = (const uint8_t*) columns[(g + 0 < n) ? g + 0 : n - 1];
+      const uint8_t* col1 = (const uint8_t*) columns[(g + 1 < n) ? g + 1 : n - 1];
+      const uint8_t* col2 = (const uint8_t*) columns[(g + 2 < n) ? g + 2 : n - 1];
+      const uint8_t* col3 = (const uint8_t*) columns[(g + 3 < n) ? g + 3 : n - 1];
+      __m256i cnt0 = _mm256_setzero_si256();
+      __m256i cnt1 = _mm256_setzero_si256();
+      __m256i cnt2 = _mm256_setzero_si256();
+      __m256i cnt3 = _mm256_setzero_si256();
+
+      for (uint64_t i = first; i < last; i += 32)
+      {
+        __m256i m = _mm256_loadu_si256((const __m256i*) &mask[i]);
+        __m256i vec0 = _mm256_and_si256(m, _mm256_loadu_si256((const __m256i*) &col0[i]));
+        __m256i vec1 = _mm256_and_si256(m, _mm256_loadu_si256((const __m256i*) &col1[i]));
+        __m256i vec2 = _mm256_and_si256(m, _mm256_loadu_si256((const __m256i*) &col2[i]));
+        __m256i vec3 = _mm256_and_si256(m, _mm256_loadu_si256((const __m256i*) &col3[i]));
+
+        cnt0 = _mm256_add_epi64(cnt0, popcnt256(vec0));
+        cnt1 = _mm256_add_epi64(cnt1, popcnt256(vec1));
+        cnt2 = _mm256_add_epi64(cnt2, popcnt256(vec2));
+        cnt3 = _mm256_add_epi64(cnt3, popcnt256(vec3));
+      }
+
+      uint64_t sums[4];
+      _mm256_storeu_si256((__m256i*) sums, reduce4_avx2(cnt0, cnt1, cnt2, cnt3));
+
+      for (int r = 0; r < 4 && g + r < n; r++)
+        out[g + r] += sums[r];
+    }
+  }
+
+  /* Process last 31 bytes */
+  if (limit < size)
+  {
+    for (int j = 0; j < n; j++)
+      out[j] += popcnt_op_u64(&mask[limit], (const uint8_t*) columns[j] + limit, size - limit, LIBPOPCNT_OP_AND, LIBPOPCNT_BIT_POPCNT);
+  }
+}
+
+/*
+ * dst = dst op src for n blocks of 512 bytes, fused with
+ * counting the 1 bits of each resulting block using the
+ * Harley-Seal algorithm while the block is in registers.
+ * @counts: counts[b] = popcnt of block b of dst
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx2")))
+#endif
+static inline void popcnt_op_blocks_avx2(uint8_t* dst, const uint8_t* src, uint64_t n, int op, uint64_t* counts)
+{
+  __m256i v[16];
+
+  for (uint64_t b = 0; b < n; b++)
+  {
+    __m256i* dst256 = (__m256i*) &dst[b * 512];
+    const __m256i* src256 = (const __m256i*) &src[b * 512];
+    libpopcnt_hs256 hs;
+    hs256_init(&hs);
+
+    for (int j = 0; j < 16; j++)
+    {
+      v[j] = combine256(_mm256_loadu_si256(dst256 + j), _mm256_loadu_si256(src256 + j), op);
+      _mm256_storeu_si256(dst256 + j, v[j]);
+    }
+
+    hs256_add16(&hs, v);
+    counts[b] = hs256_sum(&hs);
+  }
+}
+
+#endif
+
+#if defined(LIBPOPCNT_HAVE_AVX512) && \
+    __has_include(<immintrin.h>)
+
+#include <immintrin.h>
+
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f,avx512bw,avx512vpopcntdq")))
+#endif
+static inline uint64_t popcnt_avx512(const uint8_t* ptr8, uint64_t size)
+{
+    __m512i cnt = _mm512_setzero_si512();
+    const uint64_t* ptr64 = (const uint64_t*) ptr8;
+    uint64_t size64 = size / sizeof(uint64_t);
+    uint64_t i = 0;
+
+    for (; i + 32 <= size64; i += 32)
+    {
+      __m512i vec0 = _mm512_loadu_epi64(&ptr64[i + 0]);
+      __m512i vec1 = _mm512_loadu_epi64(&ptr64[i + 8]);
+      __m512i vec2 = _mm512_loadu_epi64(&ptr64[i + 16]);
+      __m512i vec3 = _mm512_loadu_epi64(&ptr64[i + 24]);
+
+      vec0 = _mm512_popcnt_epi64(vec0);
+      vec1 = _mm512_popcnt_epi64(vec1);
+      vec2 = _mm512_popcnt_epi64(vec2);
+      vec3 = _mm512_popcnt_epi64(vec3);
+
+      cnt = _mm512_add_epi64(cnt, vec0);
+      cnt = _mm512_add_epi64(cnt, vec1);
+      cnt = _mm512_add_epi64(cnt, vec2);
+      cnt = _mm512_add_epi64(cnt, vec3);
+    }
+
+    for (; i + 8 <= size64; i += 8)
+    {
+      __m512i vec = _mm512_loadu_epi64(&ptr64[i]);
+      vec = _mm512_popcnt_epi64(vec);
+      cnt = _mm512_add_epi64(cnt, vec);
+    }
+
+    i *= sizeof(uint64_t);
+
+    /* Process last 63 bytes */
+    if (i < size)
+    {
+      __mmask64 mask = (__mmask64) (0xffffffffffffffffull >> (i + 64 - size));
+      __m512i vec = _mm512_maskz_loadu_epi8(mask, &ptr8[i]);
+      vec = _mm512_popcnt_epi64(vec);
+      cnt = _mm512_add_epi64(cnt, vec);
+    }
+
+    return _mm512_reduce_add_epi64(cnt);
+}
+
+/*
+ * AVX512 popcount for arrays that do not fit into the
+ * CPU's last level cache. Prefetches the data using the
+ * non-temporal hint to minimize cache pollution.
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f,avx512bw,avx512vpopcntdq")))
+#endif
+static inline uint64_t popcnt_avx512_stream(const uint8_t* ptr8, uint64_t size)
+{
+    __m512i cnt = _mm512_setzero_si512();
+    const uint64_t* ptr64 = (const uint64_t*) ptr8;
+    uint64_t size64 = size / sizeof(uint64_t);
+    uint64_t distance = LIBPOPCNT_PREFETCH_DISTANCE / sizeof(uint64_t);
+    uint64_t i = 0;
+
+    for (; i + distance + 32 <= size64; i += 32)
+    {
+      _mm_prefetch((const char*) &ptr64[i + distance + 0], _MM_HINT_NTA);
+      _mm_prefetch((const char*) &ptr64[i + distance + 8], _MM_HINT_NTA);
+      _mm_prefetch((const char*) &ptr64[i + distance + 16], _MM_HINT_NTA);
+      _mm_prefetch((const char*) &ptr64[i + distance + 24], _MM_HINT_NTA);
+
+      __m512i vec0 = _mm512_loadu_epi64(&ptr64[i + 0]);
+      __m512i vec1 = _mm512_loadu_epi64(&ptr64[i + 8]);
+      __m512i vec2 = _mm512_loadu_epi64(&ptr64[i + 16]);
+      __m512i vec3 = _mm512_loadu_epi64(&ptr64[i + 24]);
+
+      vec0 = _mm512_popcnt_epi64(vec0);
+      vec1 = _mm512_popcnt_epi64(vec1);
+      vec2 = _mm512_popcnt_epi64(vec2);
+      vec3 = _mm512_popcnt_epi64(vec3);
+
+      cnt = _mm512_add_epi64(cnt, vec0);
+      cnt = _mm512_add_epi64(cnt, vec1);
+      cnt = _mm512_add_epi64(cnt, vec2);
+      cnt = _mm512_add_epi64(cnt, vec3);
+    }
+
+    i *= sizeof(uint64_t);
+
+    /* Process last 1 KiB */
+    return _mm512_reduce_add_epi64(cnt) +
+           popcnt_avx512(&ptr8[i], size - i);
+}
+
+/* Mask of the next min(size - i, 64) bytes */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f,avx512bw")))
+#endif
+static inline __mmask64 get_mask_avx512(uint64_t i, uint64_t size)
+{
+  uint64_t bytes = (i < size) ? size - i : 0;
+  return (__mmask64) ((bytes < 64) ? (1ull << bytes) - 1 : 0xffffffffffffffffull);
+}
+
+/*
+ * AVX512 popcount of many small arrays. Counts 4 arrays
+ * simultaneously, this way the latency of the loads and
+ * VPOPCNTQ instructions of one array is hidden by the
+ * instructions of the other arrays.
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f,avx512bw,avx512vpopcntdq")))
+#endif
+static inline void popcnt_batch_avx512(const void* const* ptrs,
+                                       const uint64_t* sizes,
+                                       uint64_t n,
+                                       uint64_t* out)
+{
+  uint64_t i = 0;
+  uint64_t limit = n - n % 4;
+
+  for (; i < limit; i += 4)
+  {
+    const uint8_t* ptr0 = (const uint8_t*) ptrs[i + 0];
+    const uint8_t* ptr1 = (const uint8_t*) ptrs[i + 1];
+    const uint8_t* ptr2 = (const uint8_t*) ptrs[i + 2];
+    const uint8_t* ptr3 = (const uint8_t*) ptrs[i + 3];
+    uint64_t size0 = sizes[i + 0];
+    uint64_t size1 = sizes[i + 1];
+    uint64_t size2 = sizes[i + 2];
+    uint64_t size3 = sizes[i + 3];
+    uint64_t max_size = size0;
+    max_size = (size1 > max_size) ? size1 : max_size;
+    max_size = (size2 > max_size) ? size2 : max_size;
+    max_size = (size3 > max_size) ? size3 : max_size;
+
+    /* Interleaving only pays off for small arrays */
+    if (max_size > 1024)
+    {
+      out[i + 0] = popcnt_avx512(ptr0, size0);
+      out[i + 1] = popcnt_avx512(ptr1, size1);
+      out[i + 2] = popcnt_avx512(ptr2, size2);
+      out[i + 3] = popcnt_avx512(ptr3, size3);
+      continue;
+    }
+
+    __m512i cnt0 = _mm512_setzero_si512();
+    __m512i cnt1 = _mm512_setzero_si512();
+    __m512i cnt2 = _mm512_setzero_si512();
+    __m512i cnt3 = _mm512_setzero_si512();
+
+    for (uint64_t j = 0; j < max_size; j += 64)
+    {
+      __m512i vec0 = _mm512_maskz_loadu_epi8(get_mask_avx512(j, size0), &ptr0[j]);
+      __m512i vec1 = _mm512_maskz_loadu_epi8(get_mask_avx512(j, size1), &ptr1[j]);
+      __m512i vec2 = _mm512_maskz_loadu_epi8(get_mask_avx512(j, size2), &ptr2[j]);
+      __m512i vec3 = _mm512_maskz_loadu_epi8(get_mask_avx512(j, size3), &ptr3[j]);
+
+      cnt0 = _mm512_add_epi64(cnt0, _mm512_popcnt_epi64(vec0));
+      cnt1 = _mm512_add_epi64(cnt1, _mm512_popcnt_epi64(vec1));
+      cnt2 = _mm512_add_epi64(cnt2, _mm512_popcnt_epi64(vec2));
+      cnt3 = _mm512_add_epi64(cnt3, _mm512_popcnt_epi64(vec3));
+    }
+
+    /* Horizontal sums of the 4 counters */
+    __m512i cnt01 = _mm512_add_epi64(_mm512_unpacklo_epi64(cnt0, cnt1), _mm512_unpackhi_epi64(cnt0, cnt1));
+    __m512i cnt23 = _mm512_add_epi64(_mm512_unpacklo_epi64(cnt2, cnt3), _mm512_unpackhi_epi64(cnt2, cnt3));
+    __m512i sum = _mm512_add_epi64(_mm512_shuffle_i64x2(cnt01, cnt23, 0x44), _mm512_shuffle_i64x2(cnt01, cnt23, 0xEE));
+    sum = _mm512_add_epi64(sum, _mm512_shuffle_i64x2(sum, sum, 0xB1));
+    sum = _mm512_shuffle_i64x2(sum, sum, 0x08);
+    _mm256_storeu_si256((__m256i*) &out[i], _mm512_castsi512_si256(sum));
+  }
+
+  for (; i < n; i++)
+    out[i] = popcnt_avx512((const uint8_t*) ptrs[i], sizes[i]);
+}
+
+/* Sums of the 64-bit lanes of 8 vectors: [sum(v0), ..., sum(v7)] */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f")))
+#endif
+static inline __m512i reduce8_avx512(__m512i v0, __m512i v1, __m512i v2, __m512i v3,
+                                     __m512i v4, __m512i v5, __m512i v6, __m512i v7)
+{
+  __m512i v01 = _mm512_add_epi64(_mm512_unpacklo_epi64(v0, v1), _mm512_unpackhi_epi64(v0, v1));
+  __m512i v23 = _mm512_add_epi64(_mm512_unpacklo_epi64(v2, v3), _mm512_unpackhi_epi64(v2, v3));
+  __m512i v45 = _mm512_add_epi64(_mm512_unpacklo_epi64(v4, v5), _mm512_unpackhi_epi64(v4, v5));
+  __m512i v67 = _mm512_add_epi64(_mm512_unpacklo_epi64(v6, v7), _mm512_unpackhi_epi64(v6, v7));
+  __m512i v0123 = _mm512_add_epi64(_mm512_shuffle_i64x2(v01, v23, 0x88), _mm512_shuffle_i64x2(v01, v23, 0xDD));
+  __m512i v4567 = _mm512_add_epi64(_mm512_shuffle_i64x2(v45, v67, 0x88), _mm512_shuffle_i64x2(v45, v67, 0xDD));
+
+  return _mm512_add_epi64(_mm512_shuffle_i64x2(v0123, v4567, 0x88),
+                          _mm512_shuffle_i64x2(v0123, v4567, 0xDD));
+}
+
+/*
+ * AVX512 popcount of n records of k * 64 bytes each.
+ * The counts of 8 records are stored using one store.
+ * Inlined into the kernels below, one for each record
+ * size, where k is a constant: the loop over the
+ * vectors of a record is fully unrolled for small
+ * records and has a constant trip count otherwise.
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f,avx512bw,avx512vpopcntdq")))
+#endif
+LIBPOPCNT_ALWAYS_INLINE
+static inline void popcnt_records_avx512(const uint8_t* ptr, uint64_t k, uint64_t n, uint64_t* out)
+{
+  uint64_t record_size = k * 64;
+  uint64_t i = 0;
+  uint64_t limit = n - n % 8;
+
+  for (; i < limit; i += 8)
+  {
+    const uint8_t* rec = &ptr[i * record_size];
+    __m512i cnt0 = _mm512_setzero_si512();
+    __m512i cnt1 = _mm512_setzero_si512();
+    __m512i cnt2 = _mm512_setzero_si512();
+    __m512i cnt3 = _mm512_setzero_si512();
+    __m512i cnt4 = _mm512_setzero_si512();
+    __m512i cnt5 = _mm512_setzero_si512();
+    __m512i cnt6 = _mm512_setzero_si512();
+    __m512i cnt7 = _mm512_setzero_si512();
+
+    for (uint64_t j = 0; j < record_size; j += 64)
+    {
+      cnt0 = _mm512_add_epi64(cnt0, _mm512_popcnt_epi64(_mm512_loadu_si512(rec + record_size * 0 + j)));
+      cnt1 = _mm512_add_epi64(cnt1, _mm512_popcnt_epi64(_mm512_loadu_si512(rec + record_size * 1 + j)));
+      cnt2 = _mm512_add_epi64(cnt2, _mm512_popcnt_epi64(_mm512_loadu_si512(rec + record_size * 2 + j)));
+      cnt3 = _mm512_add_epi64(cnt3, _mm512_popcnt_epi64(_mm512_loadu_si512(rec + record_size * 3 + j)));
+      cnt4 = _mm512_add_epi64(cnt4, _mm512_popcnt_epi64(_mm512_loadu_si512(rec + record_size * 4 + j)));
+      cnt5 = _mm512_add_epi64(cnt5, _mm512_popcnt_epi64(_mm512_loadu_si512(rec + record_size * 5 + j)));
+      cnt6 = _mm512_add_epi64(cnt6, _mm512_popcnt_epi64(_mm512_loadu_si512(rec + record_size * 6 + j)));
+      cnt7 = _mm512_add_epi64(cnt7, _mm512_popcnt_epi64(_mm512_loadu_si512(rec + record_size * 7 + j)));
+    }
+
+    _mm512_storeu_si512(&out[i], reduce8_avx512(cnt0, cnt1, cnt2, cnt3,
+                                                 cnt4, cnt5, cnt6, cnt7));
+  }
+
+  for (; i < n; i++)
+    out[i] = popcnt_avx512(&ptr[i * record_size], record_size);
+}
+
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f,avx512bw,avx512vpopcntdq")))
+#endif
+static inline void popcnt_records64_avx512(const uint8_t* ptr, uint64_t n, uint64_t* out)
+{
+  popcnt_records_avx512(ptr, 1, n, out);
+}
+
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f,avx512bw,avx512vpopcntdq")))
+#endif
+static inline void popcnt_records128_avx512(const uint8_t* ptr, uint64_t n, uint64_t* out)
+{
+  popcnt_records_avx512(ptr, 2, n, out);
+}
+
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f,avx512bw,avx512vpopcntdq")))
+#endif
+static inline void popcnt_records256_avx512(const uint8_t* ptr, uint64_t n, uint64_t* out)
+{
+  popcnt_records_avx512(ptr, 4, n, out);
+}
+
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f,avx512bw,avx512vpopcntdq")))
+#endif
+static inline void popcnt_records512_avx512(const uint8_t* ptr, uint64_t n, uint64_t* out)
+{
+  popcnt_records_avx512(ptr, 8, n, out);
+}
+
+/*
+ * AVX512 popcount of n records of 32 bytes each.
+ * Each vector holds 2 records, the counts of
+ * 8 records are stored using one store.
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f,avx512bw,avx512vpopcntdq")))
+#endif
+static inline void popcnt_records32_avx512(const uint8_t* ptr, uint64_t n, uint64_t* out)
+{
+  uint64_t i = 0;
+  uint64_t limit = n - n % 8;
+  __m512i idx = _mm512_setr_epi64(0, 4, 8, 12, 0, 0, 0, 0);
+
+  for (; i < limit; i += 8)
+  {
+    __m512i cnt[4];
+
+    for (uint64_t r = 0; r < 4; r++)
+    {
+      /* Sum of record 0 in lane 0, sum of record 1 in lane 4 */
+      __m512i vec = _mm512_popcnt_epi64(_mm512_loadu_si512(&ptr[(i + r * 2) * 32]));
+      vec = _mm512_add_epi64(vec, _mm512_shuffle_epi32(vec, _MM_PERM_BADC));
+      cnt[r] = _mm512_add_epi64(vec, _mm512_shuffle_i64x2(vec, vec, 0xB1));
+    }
+
+    __m512i cnt01 = _mm512_permutex2var_epi64(cnt[0], idx, cnt[1]);
+    __m512i cnt23 = _mm512_permutex2var_epi64(cnt[2], idx, cnt[3]);
+    cnt01 = _mm512_inserti64x4(cnt01, _mm512_castsi512_si256(cnt23), 1);
+    _mm512_storeu_si512(&out[i], cnt01);
+  }
+
+  for (; i < n; i++)
+    out[i] = popcnt_avx512(&ptr[i * 32], 32);
+}
+
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f")))
+#endif
+static inline __m512i combine512(__m512i a, __m512i b, int op)
+{
+  if (op == LIBPOPCNT_OP_XOR)
+    return _mm512_xor_si512(a, b);
+  if (op == LIBPOPCNT_OP_AND)
+    return _mm512_and_si512(a, b);
+  return _mm512_or_si512(a, b);
+}
+
+/*
+ * AVX512 popcount of (a op b).
+ * Inlined into the kernels below, one for each op.
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f,avx512bw,avx512vpopcntdq")))
+#endif
+LIBPOPCNT_ALWAYS_INLINE
+static inline uint64_t popcnt_op_avx512(const uint8_t* a, const uint8_t* b, uint64_t size, int op)
+{
+  __m512i cnt = _mm512_setzero_si512();
+  uint64_t i = 0;
+
+  for (; i + 256 <= size; i += 256)
+  {
+    __m512i vec0 = combine512(_mm512_loadu_si512(&a[i + 0]), _mm512_loadu_si512(&b[i + 0]), op);
+    __m512i vec1 = combine512(_mm512_loadu_si512(&a[i + 64]), _mm512_loadu_si512(&b[i + 64]), op);
+    __m512i vec2 = combine512(_mm512_loadu_si512(&a[i + 128]), _mm512_loadu_si512(&b[i + 128]), op);
+    __m512i vec3 = combine512(_mm512_loadu_si512(&a[i + 192]), _mm512_loadu_si512(&b[i + 192]), op);
+
+    cnt = _mm512_add_epi64(cnt, _mm512_popcnt_epi64(vec0));
+    cnt = _mm512_add_epi64(cnt, _mm512_popcnt_epi64(vec1));
+    cnt = _mm512_add_epi64(cnt, _mm512_popcnt_epi64(vec2));
+    cnt = _mm512_add_epi64(cnt, _mm512_popcnt_epi64(vec3));
+  }
+
+  for (; i + 64 <= size; i += 64)
+  {
+    __m512i vec = combine512(_mm512_loadu_si512(&a[i]), _mm512_loadu_si512(&b[i]), op);
+    cnt = _mm512_add_epi64(cnt, _mm512_popcnt_epi64(vec));
+  }
+
+  /* Process last 63 bytes */
+  if (i < size)
+  {
+    __mmask64 mask = (__mmask64) (0xffffffffffffffffull >> (i + 64 - size));
+    __m512i vec = combine512(_mm512_maskz_loadu_epi8(mask, &a[i]), _mm512_maskz_loadu_epi8(mask, &b[i]), op);
+    cnt = _mm512_add_epi64(cnt, _mm512_popcnt_epi64(vec));
+  }
+
+  return _mm512_reduce_add_epi64(cnt);
+}
+
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f,avx512bw,avx512vpopcntdq")))
+#endif
+static inline uint64_t popcnt_xor_avx512(const uint8_t* a, const uint8_t* b, uint64_t size)
+{
+  return popcnt_op_avx512(a, b, size, LIBPOPCNT_OP_XOR);
+}
+
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f,avx512bw,avx512vpopcntdq")))
+#endif
+static inline uint64_t popcnt_and_avx512(const uint8_t* a, const uint8_t* b, uint64_t size)
+{
+  return popcnt_op_avx512(a, b, size, LIBPOPCNT_OP_AND);
+}
+
+/*
+ * Count the 1 bits of (query op db[r]) for the 8 arrays
+ * db[0], ..., db[7] of size bytes stored contiguously.
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f,avx512bw,avx512vpopcntdq")))
+#endif
+static inline __m512i popcnt8_op_avx512(const uint8_t* query, const uint8_t* db, uint64_t size, int op)
+{
+  __m512i cnt0 = _mm512_setzero_si512();
+  __m512i cnt1 = _mm512_setzero_si512();
+  __m512i cnt2 = _mm512_setzero_si512();
+  __m512i cnt3 = _mm512_setzero_si512();
+  __m512i cnt4 = _mm512_setzero_si512();
+  __m512i cnt5 = _mm512_setzero_si512();
+  __m512i cnt6 = _mm512_setzero_si512();
+  __m512i cnt7 = _mm512_setzero_si512();
+  uint64_t j = 0;
+
+  for (; j < size; j += 64)
+  {
+    /* The last iteration processes the last 1 - 64 bytes */
+    __mmask64 mask = (__mmask64) (0xffffffffffffffffull >> ((j + 64 <= size) ? 0 : j + 64 - size));
+    __m512i q = _mm512_maskz_loadu_epi8(mask, &query[j]);
+
+    __m512i vec0 = combine512(q, _mm512_maskz_loadu_epi8(mask, &db[0 * size + j]), op);
+    __m512i vec1 = combine512(q, _mm512_maskz_loadu_epi8(mask, &db[1 * size + j]), op);
+    __m512i vec2 = combine512(q, _mm512_maskz_loadu_epi8(mask, &db[2 * size + j]), op);
+    __m512i vec3 = combine512(q, _mm512_maskz_loadu_epi8(mask, &db[3 * size + j]), op);
+    __m512i vec4 = combine512(q, _mm512_maskz_loadu_epi8(mask, &db[4 * size + j]), op);
+    __m512i vec5 = combine512(q, _mm512_maskz_loadu_epi8(mask, &db[5 * size + j]), op);
+    __m512i vec6 = combine512(q, _mm512_maskz_loadu_epi8(mask, &db[6 * size + j]), op);
+    __m512i vec7 = combine512(q, _mm512_maskz_loadu_epi8(mask, &db[7 * size + j]), op);
+
+    cnt0 = _mm512_add_epi64(cnt0, _mm512_popcnt_epi64(vec0));
+    cnt1 = _mm512_add_epi64(cnt1, _mm512_popcnt_epi64(vec1));
+    cnt2 = _mm512_add_epi64(cnt2, _mm512_popcnt_epi64(vec2));
+    cnt3 = _mm512_add_epi64(cnt3, _mm512_popcnt_epi64(vec3));
+    cnt4 = _mm512_add_epi64(cnt4, _mm512_popcnt_epi64(vec4));
+    cnt5 = _mm512_add_epi64(cnt5, _mm512_popcnt_epi64(vec5));
+    cnt6 = _mm512_add_epi64(cnt6, _mm512_popcnt_epi64(vec6));
+    cnt7 = _mm512_add_epi64(cnt7, _mm512_popcnt_epi64(vec7));
+  }
+
+  return reduce8_avx512(cnt0, cnt1, cnt2, cnt3, cnt4, cnt5, cnt6, cnt7);
+}
+
+/*
+ * Computes the Hamming distances of the query and the
+ * next 8 fingerprints. Returns a bit mask of the fingerprints
+ * whose distance is <= threshold, the distances are stored
+ * in dist[] only if the mask is not 0.
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f,avx512bw,avx512vpopcntdq")))
+#endif
+static inline int hamming8_filter_avx512(const uint8_t* query,
+                                         const uint8_t* db,
+                                         uint64_t size,
+                                         uint64_t threshold,
+                                         uint64_t* dist)
+{
+  __m512i vdist = popcnt8_op_avx512(query, db, size, LIBPOPCNT_OP_XOR);
+  __mmask8 mask = _mm512_cmple_epu64_mask(vdist, _mm512_set1_epi64((long long) threshold));
+
+  if (mask)
+    _mm512_storeu_si512(dist, vdist);
+
+  return (int) mask;
+}
+
+/*
+ * Count the 1 bits of (query op db[j]) for 0 <= j < n,
+ * processes 8 arrays at once. Returns the number of
+ * processed arrays (n - n % 8).
+ * @out: out[j] = popcnt(query op db[j])
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f,avx512bw,avx512vpopcntdq")))
+#endif
+static inline uint64_t popcnt_op_row_avx512(const uint8_t* query,
+                                            const uint8_t* db,
+                                            uint64_t size,
+                                            uint64_t n,
+                                            int op,
+                                            uint64_t* out)
+{
+  uint64_t j = 0;
+
+  /* Keep the op check out of the inner loop */
+  if (op == LIBPOPCNT_OP_XOR)
+    for (; j + 8 <= n; j += 8)
+      _mm512_storeu_si512(&out[j], popcnt8_op_avx512(query, &db[j * size], size, LIBPOPCNT_OP_XOR));
+  else if (op == LIBPOPCNT_OP_AND)
+    for (; j + 8 <= n; j += 8)
+      _mm512_storeu_si512(&out[j], popcnt8_op_avx512(query, &db[j * size], size, LIBPOPCNT_OP_AND));
+  else
+    for (; j + 8 <= n; j += 8)
+      _mm512_storeu_si512(&out[j], popcnt8_op_avx512(query, &db[j * size], size, LIBPOPCNT_OP_OR));
+
+  return j;
+}
+
+/*
+ * Combine the next min(size - i, 64) bytes at byte
+ * offset i of the k arrays ptrs[0], ..., ptrs[k - 1].
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f,avx512bw")))
+#endif
+static inline __m512i combine_many512(const void* const* ptrs, int k, uint64_t i, __mmask64 mask, int op)
+{
+  __m512i vec = _mm512_maskz_loadu_epi8(mask, (const uint8_t*) ptrs[0] + i);
+
+  if (op == LIBPOPCNT_OP_XOR)
+    for (int j = 1; j < k; j++)
+      vec = _mm512_xor_si512(vec, _mm512_maskz_loadu_epi8(mask, (const uint8_t*) ptrs[j] + i));
+  else if (op == LIBPOPCNT_OP_AND)
+    for (int j = 1; j < k; j++)
+      vec = _mm512_and_si512(vec, _mm512_maskz_loadu_epi8(mask, (const uint8_t*) ptrs[j] + i));
+  else
+    for (int j = 1; j < k; j++)
+      vec = _mm512_or_si512(vec, _mm512_maskz_loadu_epi8(mask, (const uint8_t*) ptrs[j] + i));
+
+  return vec;
+}
+
+/*
+ * AVX512 popcount of (ptrs[0] op ... op ptrs[k - 1]).
+ * The k arrays are read only once, they are combined
+ * in registers without any temporary arrays.
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f,avx512bw,avx512vpopcntdq")))
+#endif
+static inline uint64_t popcnt_many_avx512(const void* const* ptrs, int k, uint64_t size, int op)
+{
+  __m512i cnt0 = _mm512_setzero_si512();
+  __m512i cnt1 = _mm512_setzero_si512();
+  __mmask64 all = (__mmask64) 0xffffffffffffffffull;
+  uint64_t i = 0;
+
+  for (; i + 128 <= size; i += 128)
+  {
+    __m512i vec0 = combine_many512(ptrs, k, i + 0, all, op);
+    __m512i vec1 = combine_many512(ptrs, k, i + 64, all, op);
+    cnt0 = _mm512_add_epi64(cnt0, _mm512_popcnt_epi64(vec0));
+    cnt1 = _mm512_add_epi64(cnt1, _mm512_popcnt_epi64(vec1));
+  }
+
+  /* Process last 127 bytes */
+  for (; i < size; i += 64)
+  {
+    __mmask64 mask = (__mmask64) (0xffffffffffffffffull >> ((i + 64 <= size) ? 0 : i + 64 - size));
+    __m512i vec = combine_many512(ptrs, k, i, mask, op);
+    cnt0 = _mm512_add_epi64(cnt0, _mm512_popcnt_epi64(vec));
+  }
+
+  return _mm512_reduce_add_epi64(_mm512_add_epi64(cnt0, cnt1));
+}
+
+/*
+ * Carry-save adder using VPTERNLOGQ,
+ * h = majority(a, b, c), l = a ^ b ^ c.
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f")))
+#endif
+static inline void CSA512(__m512i* h, __m512i* l, __m512i a, __m512i b, __m512i c)
+{
+  *h = _mm512_ternarylogic_epi64(a, b, c, 0xE8);
+  *l = _mm512_ternarylogic_epi64(a, b, c, 0x96);
+}
+
+/* AVX512 version of popcnt_vertical_u64(), processes 64 bytes at once */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f,avx512bw,avx512vpopcntdq")))
+#endif
+static inline uint64_t popcnt_vertical_avx512(const void* const* ptrs,
+                                              int n,
+                                              int planes_n,
+                                              uint64_t limit,
+                                              uint64_t size,
+                                              uint8_t* planes,
+                                              int m,
+                                              uint8_t* out)
+{
+  __m512i cnt = _mm512_setzero_si512();
+
+  for (uint64_t i = 0; i < limit; i += 64)
+  {
+    __m512i p[32];
+    __m512i pending[32];
+    uint32_t mask = 0;
+
+    for (int b = 0; b < planes_n; b++)
+      p[b] = _mm512_setzero_si512();
+
+    for (int k = 0; k < n; k++)
+    {
+      __m512i x = _mm512_loadu_si512((const uint8_t*) ptrs[k] + i);
+      int l = 0;
+
+      for (; mask & (1u << l); l++)
+        CSA512(&x, &p[l], p[l], pending[l], x);
+
+      mask = (mask & ~((1u << l) - 1)) | (1u << l);
+      pending[l] = x;
+    }
+
+    /* Add the remaining inputs using half adders */
+    for (int l = 0; l < planes_n; l++)
+    {
+      if (mask & (1u << l))
+      {
+        __m512i x = pending[l];
+        for (int b = l; b < planes_n; b++)
+        {
+          __m512i carry = _mm512_and_si512(p[b], x);
+          p[b] = _mm512_xor_si512(p[b], x);
+          x = carry;
+        }
+      }
+    }
+
+    if (planes)
+    {
+      for (int b = 0; b < planes_n; b++)
+        _mm512_storeu_si512(&planes[b * size + i], p[b]);
+    }
+
+    if (m > 0)
+    {
+      __m512i gt = _mm512_setzero_si512();
+      __m512i eq = _mm512_set1_epi64(-1);
+
+      for (int b = planes_n - 1; b >= 0; b--)
+      {
+        if ((m >> b) & 1)
+          eq = _mm512_and_si512(eq, p[b]);
+        else
+        {
+          gt = _mm512_or_si512(gt, _mm512_and_si512(eq, p[b]));
+          eq = _mm512_andnot_si512(p[b], eq);
+        }
+      }
+
+      __m512i ge = _mm512_or_si512(gt, eq);
+      cnt = _mm512_add_epi64(cnt, _mm512_popcnt_epi64(ge));
+      if (out)
+        _mm512_storeu_si512(&out[i], ge);
+    }
+  }
+
+  return _mm512_reduce_add_epi64(cnt);
+}
+
+/* x ^ (x << 1) of the 64 bytes at ptr[i], the carry bits are read from ptr[i - 8] */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f")))
+#endif
+static inline __m512i transitions512(const uint8_t* ptr, uint64_t i)
+{
+  __m512i x = _mm512_loadu_si512(&ptr[i]);
+  __m512i prev = _mm512_loadu_si512(&ptr[i - 8]);
+  __m512i shifted = _mm512_or_si512(_mm512_slli_epi64(x, 1), _mm512_srli_epi64(prev, 63));
+  return _mm512_xor_si512(x, shifted);
+}
+
+/*
+ * AVX512 popcount of x ^ (x << 1) for the bytes
+ * ptr[i], ..., ptr[limit - 1], requires i >= 8 and
+ * (limit - i) % 64 == 0.
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f,avx512bw,avx512vpopcntdq")))
+#endif
+static inline uint64_t popcnt_transitions_avx512(const uint8_t* ptr, uint64_t i, uint64_t limit)
+{
+  __m512i cnt0 = _mm512_setzero_si512();
+  __m512i cnt1 = _mm512_setzero_si512();
+
+  for (; i + 128 <= limit; i += 128)
+  {
+    __m512i vec0 = transitions512(ptr, i + 0);
+    __m512i vec1 = transitions512(ptr, i + 64);
+    cnt0 = _mm512_add_epi64(cnt0, _mm512_popcnt_epi64(vec0));
+    cnt1 = _mm512_add_epi64(cnt1, _mm512_popcnt_epi64(vec1));
+  }
+
+  for (; i < limit; i += 64)
+    cnt0 = _mm512_add_epi64(cnt0, _mm512_popcnt_epi64(transitions512(ptr, i)));
+
+  return _mm512_reduce_add_epi64(_mm512_add_epi64(cnt0, cnt1));
+}
+
+/*
+ * AVX512 bitmap decoding, the indexes of the set bits of
+ * 16 bits are computed using a single VPCOMPRESSD and stored
+ * using a masked store, hence no extra space is needed in out.
+ * Returns the new position in out.
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f")))
+#endif
+static inline uint64_t bitmap_decode_avx512(const uint8_t* ptr, uint64_t words, uint32_t* out)
+{
+  __m512i idx = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  __m512i sixteen = _mm512_set1_epi32(16);
+  uint64_t pos = 0;
+
+  for (uint64_t i = 0; i < words; i++)
+  {
+    uint64_t x = load64(&ptr[i * 8]);
+    if (x == 0)
+      continue;
+
+    __m512i base = _mm512_add_epi32(idx, _mm512_set1_epi32((int) (i * 64)));
+
+    for (int j = 0; j < 4; j++)
+    {
+      __mmask16 mask = (__mmask16) (x >> (j * 16));
+      uint64_t cnt = popcnt64_cpuid(mask, LIBPOPCNT_BIT_POPCNT);
+      __m512i vec = _mm512_maskz_compress_epi32(mask, base);
+      _mm512_mask_storeu_epi32(&out[pos], (__mmask16) ((1u << cnt) - 1), vec);
+      base = _mm512_add_epi32(base, sixteen);
+      pos += cnt;
+    }
+  }
+
+  return pos;
+}
+
+/*
+ * Skip the 256 byte blocks before the block that contains
+ * the k-th set bit, the blocks are counted using VPOPCNTQ.
+ * Returns the offset of that block (or of the last bytes),
+ * k is updated accordingly.
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f,avx512bw,avx512vpopcntdq")))
+#endif
+static inline uint64_t popcnt_select_avx512(const uint8_t* ptr, uint64_t size, uint64_t* k)
+{
+  uint64_t i = 0;
+
+  for (; i + 256 <= size; i += 256)
+  {
+    __m512i vec0 = _mm512_popcnt_epi64(_mm512_loadu_si512(&ptr[i + 0]));
+    __m512i vec1 = _mm512_popcnt_epi64(_mm512_loadu_si512(&ptr[i + 64]));
+    __m512i vec2 = _mm512_popcnt_epi64(_mm512_loadu_si512(&ptr[i + 128]));
+    __m512i vec3 = _mm512_popcnt_epi64(_mm512_loadu_si512(&ptr[i + 192]));
+    __m512i cnt = _mm512_add_epi64(_mm512_add_epi64(vec0, vec1), _mm512_add_epi64(vec2, vec3));
+    uint64_t cnt64 = (uint64_t) _mm512_reduce_add_epi64(cnt);
+
+    if (cnt64 > *k)
+      break;
+    *k -= cnt64;
+  }
+
+  return i;
+}
+
+/*
+ * AVX512 popcount of (mask AND columns[j]) for 0 <= j < n.
+ * The bitmaps are processed in chunks of 16 KiB, for each
+ * chunk 8 columns are counted at once. Each mask vector is
+ * loaded once per 8 columns and read from memory only once
+ * as the mask chunk stays in the CPU's cache.
+ * @out: out[j] += popcnt(mask AND columns[j])
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f,avx512bw,avx512vpopcntdq")))
+#endif
+static inline void popcnt_masked_avx512(const uint8_t* mask, const void* const* columns, int n, uint64_t size, uint64_t* out)
+{
+  uint64_t chunk = 16 << 10;
+
+  for (uint64_t first = 0; first < size; first += chunk)
+  {
+    uint64_t last = (size - first > chunk) ? first + chunk : size;
+
+    for (int g = 0; g < n; g += 8)
+    {
+      /* Pad the last group with the last column */
+      const uint8_t* col0 = (const uint8_t*) columns[(g + 0 < n) ? g + 0 : n - 1];
+      const uint8_t* col1 = (const uint8_t*) columns[(g + 1 < n) ? g + 1 : n - 1];
+      const uint8_t* col2 = (const uint8_t*) columns[(g + 2 < n) ? g + 2 : n - 1];
+      const uint8_t* col3 = (const uint8_t*) columns[(g + 3 < n) ? g + 3 : n - 1];
+      const uint8_t* col4 = (const uint8_t*) columns[(g + 4 < n) ? g + 4 : n - 1];
+      const uint8_t* col5 = (const uint8_t*) columns[(g + 5 < n) ? g + 5 : n - 1];
+      const uint8_t* col6 = (const uint8_t*) columns[(g + 6 < n) ? g + 6 : n - 1];
+      const uint8_t* col7 = (const uint8_t*) columns[(g + 7 < n) ? g + 7 : n - 1];
+      __m512i cnt0 = _mm512_setzero_si512();
+      __m512i cnt1 = _mm512_setzero_si512();
+      __m512i cnt2 = _mm512_setzero_si512();
+      __m512i cnt3 = _mm512_setzero_si512();
+      __m512i cnt4 = _mm512_setzero_si512();
+      __m512i cnt5 = _mm512_setzero_si512();
+      __m512i cnt6 = _mm512_setzero_si512();
+      __m512i cnt7 = _mm512_setzero_si512();
+
+      for (uint64_t i = first; i < last; i += 64)
+      {
+        /* The last iteration processes the last 1 - 64 bytes */
+        __mmask64 k = (__mmask64) (0xffffffffffffffffull >> ((i + 64 <= last) ? 0 : i + 64 - last));
+        __m512i m = _mm512_maskz_loadu_epi8(k, &mask[i]);
+
+        cnt0 = _mm512_add_epi64(cnt0, _mm512_popcnt_epi64(_mm512_and_si512(m, _mm512_maskz_loadu_epi8(k, &col0[i]))));
+        cnt1 = _mm512_add_epi64(cnt1, _mm512_popcnt_epi64(_mm512_and_si512(m, _mm512_maskz_loadu_epi8(k, &col1[i]))));
+        cnt2 = _mm512_add_epi64(cnt2, _mm512_popcnt_epi64(_mm512_and_si512(m, _mm512_maskz_loadu_epi8(k, &col2[i]))));
+        cnt3 = _mm512_add_epi64(cnt3, _mm512_popcnt_epi64(_mm512_and_si512(m, _mm512_maskz_loadu_epi8(k, &col3[i]))));
+        cnt4 = _mm512_add_epi64(cnt4, _mm512_popcnt_epi64(_mm512_and_si512(m, _mm512_maskz_loadu_epi8(k, &col4[i]))));
+        cnt5 = _mm512_add_epi64(cnt5, _mm512_popcnt_epi64(_mm512_and_si512(m, _mm512_maskz_loadu_epi8(k, &col5[i]))));
+        cnt6 = _mm512_add_epi64(cnt6, _mm512_popcnt_epi64(_mm512_and_si512(m, _mm512_maskz_loadu_epi8(k, &col6[i]))));
+        cnt7 = _mm512_add_epi64(cnt7, _mm512_popcnt_epi64(_mm512_and_si512(m, _mm512_maskz_loadu_epi8(k, &col7[i]))));
+      }
+
+      uint64_t sums[8];
+      _mm512_storeu_si512(sums, reduce8_avx512(cnt0, cnt1, cnt2, cnt3, cnt4, cnt5, cnt6, cnt7));
+
+      for (int r = 0; r < 8 && g + r < n; r++)
+        out[g + r] += sums[r];
+    }
+  }
+}
+
+/*
+ * dst = dst op src for n blocks of 512 bytes, fused with
+ * counting the 1 bits of each resulting block.
+ * @counts: counts[b] = popcnt of block b of dst
+ */
+#if __has_attribute(target)
+  __attribute__ ((target ("avx512f,avx512bw,avx512vpopcntdq")))
+#endif
+static inline void popcnt_op_blocks_avx512(uint8_t* dst, const uint8_t* src, uint64_t n, int op, uint64_t* counts)
+{
+  for (uint64_t b = 0; b < n; b++)
+  {
+    uint8_t* d = &dst[b * 512];
+    const uint8_t* s = &src[b * 512];
+    __m512i cnt0 = _mm512_setzero_si512();
+    __m512i cnt1 = _mm512_setzero_si512();
+
+    for (int j = 0; j < 512; j += 128)
+    {
+      __m512i vec0 = combine512(_mm512_loadu_si512(&d[j + 0]), _mm512_loadu_si512(&s[j + 0]), op);
+      __m512i vec1 = combine512(_mm512_loadu_si512(&d[j + 64]), _mm512_loadu_si512(&s[j + 64]), op);
+      _mm512_storeu_si512(&d[j + 0], vec0);
+      _mm512_storeu_si512(&d[j + 64], vec1);
+      cnt0 = _mm512_add_epi64(cnt0, _mm512_popcnt_epi64(vec0));
+      cnt1 = _mm512_add_epi64(cnt1, _mm512_popcnt_epi64(vec1));
+    }
+
+    counts[b] = (uint64_t) _mm512_reduce_add_epi64(_mm512_add_epi64(cnt0, cnt1));
+  }
+}
+
+#endif
+
+/* x86 CPUs */
+#if defined(LIBPOPCNT_X86_OR_X64)
+
+/*
+ * Count the number of 1 bits in the data array
+ * @data: An array
+ * @size: Size of data in bytes
+ */
+static uint64_t popcnt(const void* data, uint64_t size)
+{
+/*
+ * CPUID runtime checks are only enabled if this is needed.
+ * E.g. CPUID is disabled when a user compiles his
+ * code using -march=native on a CPU with AVX512.
+ */
+#if defined(LIBPOPCNT_HAVE_CPUID)
+  int cpuid = get_cpuid_flags();
+#endif
+
+  const uint8_t* ptr = (const uint8_t*) data;
+  uint64_t cnt = 0;
+  uint64_t i = 0;
+
+#if defined(LIBPOPCNT_HAVE_AVX512)
+  #if defined(__AVX512__) || \
+     (defined(__AVX512F__) && \
+      defined(__AVX512BW__) && \
+      defined(__AVX512VPOPCNTDQ__))
+    /* For tiny arrays AVX512 is not worth it */
+    if (i + 40 <= size)
+  #else
+    if ((cpuid & LIBPOPCNT_BIT_AVX512_VPOPCNTDQ) &&
+        i + 40 <= size)
+  #endif
+    {
+      LIBPOPCNT_ENTRY(LIBPOPCNT_KERNEL_AVX512, size);
+
+    #if defined(LIBPOPCNT_HAVE_RUN_CPUID) && \
+        defined(LIBPOPCNT_NONTEMPORAL)
+      /* Array does not fit into the CPU's cache */
+      if (size >= (1 << 20) &&
+          size >= get_stream_threshold())
+        cnt = popcnt_avx512_stream(ptr, size);
+      else
+    #endif
+        cnt = popcnt_avx512(ptr, size);
+
+      LIBPOPCNT_PROBE2(popcnt_exit, size, cnt);
+      return cnt;
+    }
+#endif
+
+#if defined(LIBPOPCNT_HAVE_AVX2)
+  #if defined(__AVX2__)
+    /* AVX2 requires arrays >= 512 bytes */
+    if (i + 512 <= size)
+  #else
+    if ((cpuid & LIBPOPCNT_BIT_AVX2) &&
+        i + 512 <= size)
+  #endif
+    {
+      const __m256i* ptr256 = (const __m256i*)(ptr + i);
+      LIBPOPCNT_ENTRY(LIBPOPCNT_KERNEL_AVX2, size);
+
+    #if defined(LIBPOPCNT_HAVE_RUN_CPUID) && \
+        defined(LIBPOPCNT_NONTEMPORAL)
+      /* Array does not fit into the CPU's cache */
+      if (size >= (1 << 20) &&
+          size >= get_stream_threshold())
+        cnt += popcnt_avx2_stream(ptr256, (size - i) / 32);
+      else
+    #endif
+        cnt += popcnt_avx2(ptr256, (size - i) / 32);
+
+      i = size - size % 32;
+    }
+#endif
+
+#if defined(LIBPOPCNT_HAVE_POPCNT)
+  /* 
+   * The user has compiled without -mpopcnt.
+   * Unfortunately the MSVC compiler does not have
+   * a POPCNT macro so we cannot get rid of the
+   * runtime check for MSVC.
+   */
+  #if !defined(__POPCNT__)
+    if (cpuid & LIBPOPCNT_BIT_POPCNT)
+  #endif
+    {
+      if (i == 0)
+        LIBPOPCNT_ENTRY(LIBPOPCNT_KERNEL_POPCNT, size);
+
+      if (i + 8 <= size)
+      {
+        uintptr_t rem = ((uintptr_t) &ptr[i]) % 8;
+
+        /* Align &ptr[i] to an 8 byte boundary */
+        if (rem != 0)
+        {
+          uint64_t val = 0;
+          uint64_t bytes = (uint64_t) (8 - rem % 8);
+          bytes = (bytes <= 7) ? bytes : 7;
+          for (uint64_t j = 0; j < bytes; j++)
+            val |= ((uint64_t) ptr[i + j]) << (j * 8);
+          cnt += popcnt64(val);
+          i += bytes;
+        }
+      }
+
+      for (; i + 8 <= size; i += 8)
+        cnt += popcnt64(*(const uint64_t*)(ptr + i));
+
+      if (i < size)
+      {
+        uint64_t val = 0;
+        uint64_t bytes = (uint64_t) (size - i);
+        bytes = (bytes <= 7) ? bytes : 7;
+        for (uint64_t j = 0; j < bytes; j++)
+          val |= ((uint64_t) ptr[i + j]) << (j * 8);
+        cnt += popcnt64(val);
+      }
+
+      LIBPOPCNT_PROBE2(popcnt_exit, size, cnt);
+      return cnt;
+    }
+#endif
+
+/*
+ * This code is used for:
+ * 1) Compiler does not support POPCNT.
+ * 2) x86 CPU does not support POPCNT (cpuid != POPCNT).
+ */
+#if !defined(LIBPOPCNT_HAVE_POPCNT) || \
+    !defined(__POPCNT__)
+
+  if (i == 0)
+    LIBPOPCNT_ENTRY(LIBPOPCNT_KERNEL_INTEGER, size);
+
+  if (i + 8 <= size)
+  {
+    uintptr_t rem = ((uintptr_t) &ptr[i]) % 8;
+
+    /* Align &ptr[i] to an 8 byte boundary */
+    if (rem != 0)
+    {
+      uint64_t val = 0;
+      uint64_t bytes = (uint64_t) (8 - rem % 8);
+      bytes = (bytes <= 7) ? bytes : 7;
+      for (uint64_t j = 0; j < bytes; j++)
+        val |= ((uint64_t) ptr[i + j]) << (j * 8);
+      cnt += popcnt64_bitwise(val);
+      i += bytes;
+    }
+  }
+
+  for (; i + 8 <= size; i += 8)
+    cnt += popcnt64_bitwise(*(const uint64_t*)(ptr + i));
+
+  if (i < size)
+  {
+    uint64_t val = 0;
+    uint64_t bytes = (uint64_t) (size - i);
+    bytes = (bytes <= 7) ? bytes : 7;
+    for (uint64_t j = 0; j < bytes; j++)
+      val |= ((uint64_t) ptr[i + j]) << (j * 8);
+    cnt += popcnt64_bitwise(val);
+  }
+
+  LIBPOPCNT_PROBE2(popcnt_exit, size, cnt);
+  return cnt;
+#endif
+}
+
+/* Compile with e.g. -march=armv8-a+sve to enable ARM SVE */
+#elif defined(__ARM_FEATURE_SVE) && \
+      __has_include(<arm_sve.h>)
+
+#include <arm_sve.h>
+
+/*
+ * Count the number of 1 bits in the data array
+ * @data: An array
+ * @size: Size of data in bytes
+ */
+static inline uint64_t popcnt(const void* data, uint64_t size)
+{
+  uint64_t i = 0;
+  const uint64_t* ptr64 = (const uint64_t*) data;
+  uint64_t size64 = size / sizeof(uint64_t);
+  svuint64_t vcnt = svdup_u64(0);
+
+  LIBPOPCNT_ENTRY(LIBPOPCNT_KERNEL_SVE, size);
+
+  for (; i + svcntd() * 4 <= size64; i += svcntd() * 4)
+  {
+    svuint64_t vec0 = svld1_u64(svptrue_b64(), &ptr64[i + svcntd() * 0]);
+    svuint64_t vec1 = svld1_u64(svptrue_b64(), &ptr64[i + svcntd() * 1]);
+    svuint64_t vec2 = svld1_u64(svptrue_b64(), &ptr64[i + svcntd() * 2]);
+    svuint64_t vec3 = svld1_u64(svptrue_b64(), &ptr64[i + svcntd() * 3]);
+
+    vec0 = svcnt_u64_x(svptrue_b64(), vec0);
+    vec1 = svcnt_u64_x(svptrue_b64(), vec1);
+    vec2 = svcnt_u64_x(svptrue_b64(), vec2);
+    vec3 = svcnt_u64_x(svptrue_b64(), vec3);
+
+    vcnt = svadd_u64_x(svptrue_b64(), vcnt, vec0);
+    vcnt = svadd_u64_x(svptrue_b64(), vcnt, vec1);
+    vcnt = svadd_u64_x(svptrue_b64(), vcnt, vec2);
+    vcnt = svadd_u64_x(svptrue_b64(), vcnt, vec3);
+  }
+
+  svbool_t pg = svwhilelt_b64(i, size64);
+
+  while (svptest_any(svptrue_b64(), pg))
+  {
+    svuint64_t vec = svld1_u64(pg, &ptr64[i]);
+    vec = svcnt_u64_z(pg, vec);
+    vcnt = svadd_u64_x(svptrue_b64(), vcnt, vec);
+    i += svcntd();
+    pg = svwhilelt_b64(i, size64);
+  }
+
+  uint64_t cnt = svaddv_u64(svptrue_b64(), vcnt);
+  uint64_t bytes = size % sizeof(uint64_t);
+
+  if (bytes != 0)
+  {
+    i = size - bytes;
+    const uint8_t* ptr8 = (const uint8_t*) data;
+    svbool_t pg8 = svwhilelt_b8(i, size);
+    svuint8_t vec = svld1_u8(pg8, &ptr8[i]);
+    svuint8_t vcnt8 = svcnt_u8_z(pg8, vec);
+    cnt += svaddv_u8(pg8, vcnt8);
+  }
+
+  LIBPOPCNT_PROBE2(popcnt_exit, size, cnt);
+  return cnt;
+}
+
+#elif (defined(__ARM_NEON) || \
+       defined(__aarch64__) || \
+       defined(_M_ARM64)) && \
+      __has_include(<arm_neon.h>)
+
+#include <arm_neon.h>
+
+#define LIBPOPCNT_HAVE_NEON
+
+static inline uint64x2_t vpadalq(uint64x2_t sum, uint8x16_t t)
+{
+  return vpadalq_u32(sum, vpaddlq_u16(vpaddlq_u8(t)));
+}
+
+/*
+ * Count the number of 1 bits in the data array
+ * @data: An array
+ * @size: Size of data in bytes
+ */
+static inline uint64_t popcnt(const void* data, uint64_t size)
+{
+  uint64_t i = 0;
+  uint64_t cnt = 0;
+  uint64_t chunk_size = 64;
+  const uint8_t* ptr = (const uint8_t*) data;
+
+  LIBPOPCNT_ENTRY(LIBPOPCNT_KERNEL_NEON, size);
+
+  if (size >= chunk_size)
+  {
+    uint64_t iters = size / chunk_size;
+    uint64x2_t sum = vcombine_u64(vcreate_u64(0), vcreate_u64(0));
+    uint8x16_t zero = vcombine_u8(vcreate_u8(0), vcreate_u8(0));
+
+    do
+    {
+      uint8x16_t t0 = zero;
+      uint8x16_t t1 = zero;
+      uint8x16_t t2 = zero;
+      uint8x16_t t3 = zero;
+
+      /*
+       * After every 31 iterations we need to add the
+       * temporary sums (t0, t1, t2, t3) to the total sum.
+       * We must ensure that the temporary sums <= 255
+       * and 31 * 8 bits = 248 which is OK.
+       */
+      uint64_t limit = (i + 31 < iters) ? i + 31 : iters;
+  
+      /* Each iteration processes 64 bytes */
+      for (; i < limit; i++)
+      {
+        uint8x16x4_t input = vld4q_u8(ptr);
+        ptr += chunk_size;
+
+        t0 = vaddq_u8(t0, vcntq_u8(input.val[0]));
+        t1 = vaddq_u8(t1, vcntq_u8(input.val[1]));
+        t2 = vaddq_u8(t2, vcntq_u8(input.val[2]));
+        t3 = vaddq_u8(t3, vcntq_u8(input.val[3]));
+      }
+
+      sum = vpadalq(sum, t0);
+      sum = vpadalq(sum, t1);
+      sum = vpadalq(sum, t2);
+      sum = vpadalq(sum, t3);
+    }
+    while (i < iters);
+
+    i = 0;
+    size %= chunk_size;
+
+    uint64_t tmp[2];
+    vst1q_u64(tmp, sum);
+    cnt += tmp[0];
+    cnt += tmp[1];
+  }
+
+  if (i + 8 <= size)
+  {
+    uintptr_t rem = ((uintptr_t) &ptr[i]) % 8;
+
+    /* Align &ptr[i] to an 8 byte boundary */
+    if (rem != 0)
+    {
+      uint64_t val = 0;
+      uint64_t bytes = (uint64_t) (8 - rem % 8);
+      bytes = (bytes <= 7) ? bytes : 7;
+      for (uint64_t j = 0; j < bytes; j++)
+        val |= ((uint64_t) ptr[i + j]) << (j * 8);
+      cnt += popcnt64(val);
+      i += bytes;
+    }
+  }
+
+  for (; i + 8 <= size; i += 8)
+    cnt += popcnt64(*(const uint64_t*)(ptr + i));
+
+  if (i < size)
+  {
+    uint64_t val = 0;
+    uint64_t bytes = (uint64_t) (size - i);
+    bytes = (bytes <= 7) ? bytes : 7;
+    for (uint64_t j = 0; j < bytes; j++)
+      val |= ((uint64_t) ptr[i + j]) << (j * 8);
+    cnt += popcnt64(val);
+  }
+
+  LIBPOPCNT_PROBE2(popcnt_exit, size, cnt);
+  return cnt;
+}
+
+/*
+ * NEON popcount of x ^ (x << 1) for the bytes
+ * ptr[i], ..., ptr[limit - 1], requires i >= 8 and
+ * (limit - i) % 16 == 0.
+ */
+static inline uint64_t popcnt_transitions_neon(const uint8_t* ptr, uint64_t i, uint64_t limit)
+{
+  uint64x2_t sum = vcombine_u64(vcreate_u64(0), vcreate_u64(0));
+  uint8x16_t zero = vcombine_u8(vcreate_u8(0), vcreate_u8(0));
+
+  while (i < limit)
+  {
+    /* The 8-bit temporary sums must be <= 255 */
+    uint64_t end = (limit - i > 31 * 16) ? i + 31 * 16 : limit;
+    uint8x16_t t = zero;
+
+    for (; i < end; i += 16)
+    {
+      uint64x2_t x = vreinterpretq_u64_u8(vld1q_u8(&ptr[i]));
+      uint64x2_t prev = vreinterpretq_u64_u8(vld1q_u8(&ptr[i - 8]));
+      uint64x2_t shifted = vorrq_u64(vshlq_n_u64(x, 1), vshrq_n_u64(prev, 63));
+      t = vaddq_u8(t, vcntq_u8(vreinterpretq_u8_u64(veorq_u64(x, shifted))));
+    }
+
+    sum = vpadalq(sum, t);
+  }
+
+  uint64_t tmp[2];
+  vst1q_u64(tmp, sum);
+
+  return tmp[0] + tmp[1];
+}
+
+/* all other CPUs */
+#else
+
+/*
+ * Count the number of 1 bits in the data array
+ * @data: An array
+ * @size: Size of data in bytes
+ */
+static inline uint64_t popcnt(const void* data, uint64_t size)
+{
+  uint64_t i = 0;
+  uint64_t cnt = 0;
+  const uint8_t* ptr = (const uint8_t*) data;
+
+  LIBPOPCNT_ENTRY(LIBPOPCNT_KERNEL_POPCNT, size);
+
+  if (i + 8 <= size)
+  {
+    uintptr_t rem = ((uintptr_t) &ptr[i]) % 8;
+
+    /* Align &ptr[i] to an 8 byte boundary */
+    if (rem != 0)
+    {
+      uint64_t val = 0;
+      uint64_t bytes = (uint64_t) (8 - rem % 8);
+      bytes = (bytes <= 7) ? bytes : 7;
+      for (uint64_t j = 0; j < bytes; j++)
+        val |= ((uint64_t) ptr[i + j]) << (j * 8);
+      cnt += popcnt64(val);
+      i += bytes;
+    }
+  }
+
+  for (; i + 8 <= size; i += 8)
+    cnt += popcnt64(*(const uint64_t*)(ptr + i));
+
+  if (i < size)
+  {
+    uint64_t val = 0;
+    uint64_t bytes = (uint64_t) (size - i);
+    bytes = (bytes <= 7) ? bytes : 7;
+    for (uint64_t j = 0; j < bytes; j++)
+      val |= ((uint64_t) ptr[i + j]) << (j * 8);
+    cnt += popcnt64(val);
+  }
+
+  LIBPOPCNT_PROBE2(popcnt_exit, size, cnt);
+  return cnt;
+}
+
+#endif
+
+/*
+ * Count the number of 1 bits in each of the n arrays.
+ * Runtime dispatching is done only once per call,
+ * this is much faster than calling popcnt() n times
+ * for small arrays.
+ * @ptrs: Array of n pointers to the arrays
+ * @sizes: Sizes of the n arrays in bytes
+ * @n: Number of arrays
+ * @out: out[i] = popcnt(ptrs[i], sizes[i])
+ */
+static inline void popcnt_batch(const void* const* ptrs,
+                                const uint64_t* sizes,
+                                uint64_t n,
+                                uint64_t* out)
+{
+  LIBPOPCNT_PROBE1(batch_entry, n);
+
+#if defined(LIBPOPCNT_HAVE_AVX512)
+  if (get_cpuid_flags() & LIBPOPCNT_BIT_AVX512_VPOPCNTDQ)
+    popcnt_batch_avx512(ptrs, sizes, n, out);
+  else
+#endif
+  {
+    for (uint64_t i = 0; i < n; i++)
+      out[i] = popcnt(ptrs[i], sizes[i]);
+  }
+
+  LIBPOPCNT_PROBE1(batch_exit, n);
+}
+
+static inline void popcnt_records_dispatch(const void* data,
+                                           uint64_t record_size,
+                                           uint64_t n,
+                                           uint64_t* out)
+{
+  const uint8_t* ptr = (const uint8_t*) data;
+
+#if defined(LIBPOPCNT_HAVE_AVX512)
+  if (get_cpuid_flags() & LIBPOPCNT_BIT_AVX512_VPOPCNTDQ)
+  {
+    switch (record_size)
+    {
+      case 32:  popcnt_records32_avx512(ptr, n, out); return;
+      case 64:  popcnt_records64_avx512(ptr, n, out); return;
+      case 128: popcnt_records128_avx512(ptr, n, out); return;
+      case 256: popcnt_records256_avx512(ptr, n, out); return;
+      case 512: popcnt_records512_avx512(ptr, n, out); return;
+      default: break;
+    }
+  }
+#endif
+
+#if defined(LIBPOPCNT_HAVE_AVX2)
+  if (get_cpuid_flags() & LIBPOPCNT_BIT_AVX2)
+  {
+    switch (record_size)
+    {
+      case 32:  popcnt_records32_avx2(ptr, n, out); return;
+      case 64:  popcnt_records64_avx2(ptr, n, out); return;
+      case 128: popcnt_records128_avx2(ptr, n, out); return;
+      case 256: popcnt_records256_avx2(ptr, n, out); return;
+      case 512: popcnt_records512_avx2(ptr, n, out); return;
+      default: break;
+    }
+  }
+#endif
+
+  for (uint64_t i = 0; i < n; i++)
+    out[i] = popcnt(&ptr[i * record_size], record_size);
+}
+
+/*
+ * Count the number of 1 bits in each of the n records.
+ * Records of 32, 64, 128, 256 and 512 bytes are counted
+ * using AVX2 and AVX512 kernels specialized for each size.
+ * @data: Array of n records stored contiguously
+ * @record_size: Size of each record in bytes
+ * @n: Number of records
+ * @out: out[i] = popcnt(data + i * record_size, record_size)
+ */
+static inline void popcnt_records(const void* data,
+                                  uint64_t record_size,
+                                  uint64_t n,
+                                  uint64_t* out)
+{
+  LIBPOPCNT_PROBE2(records_entry, n, record_size);
+  popcnt_records_dispatch(data, record_size, n, out);
+  LIBPOPCNT_PROBE1(records_exit, n);
+}
+
+/*
+ * Count the number of 1 bits in (a XOR b),
+ * i.e. the Hamming distance of a and b.
+ * @a: An array
+ * @b: An array
+ * @size: Size of a and b in bytes
+ */
+static inline uint64_t popcnt_xor(const void* a, const void* b, uint64_t size)
+{
+  const uint8_t* a8 = (const uint8_t*) a;
+  const uint8_t* b8 = (const uint8_t*) b;
+  int cpuid = get_cpuid_flags();
+
+#if defined(LIBPOPCNT_HAVE_AVX512)
+  /* For tiny arrays AVX512 is not worth it */
+  if ((cpuid & LIBPOPCNT_BIT_AVX512_VPOPCNTDQ) &&
+      size >= 40)
+    return popcnt_xor_avx512(a8, b8, size);
+#endif
+
+#if defined(LIBPOPCNT_HAVE_AVX2)
+  /* AVX2 requires arrays >= 512 bytes */
+  if ((cpuid & LIBPOPCNT_BIT_AVX2) &&
+      size >= 512)
+    return popcnt_xor_avx2(a8, b8, size);
+#endif
+
+  return popcnt_op_u64(a8, b8, size, LIBPOPCNT_OP_XOR, cpuid);
+}
+
+/*
+ * Hamming distance of a and b with early termination.
+ * The arrays are processed in chunks of increasing size
+ * (512 bytes up to 4 KiB), the counting stops as soon as the
+ * running sum exceeds limit. Returns popcnt(a XOR b) if it is
+ * <= limit, otherwise returns a number > limit.
+ * @a: An array
+ * @b: An array
+ * @size: Size of a and b in bytes
+ * @limit: Maximum Hamming distance of interest
+ */
+static inline uint64_t popcnt_xor_bounded(const void* a,
+                                          const void* b,
+                                          uint64_t size,
+                                          uint64_t limit)
+{
+  const uint8_t* a8 = (const uint8_t*) a;
+  const uint8_t* b8 = (const uint8_t*) b;
+  uint64_t cnt = 0;
+  uint64_t i = 0;
+  uint64_t chunk = 512;
+
+  while (i < size)
+  {
+    uint64_t bytes = (size - i < chunk) ? size - i : chunk;
+    cnt += popcnt_xor(&a8[i], &b8[i], bytes);
+    i += bytes;
+
+    if (cnt > limit)
+      break;
+
+    /* Small first chunks allow early exits, large
+     * chunks reduce the overhead of the checks. */
+    if (chunk < 4096)
+      chunk *= 2;
+  }
+
+  return cnt;
+}
+
+/*
+ * Count the number of 1 bits in
+ * (bitmaps[0] op ... op bitmaps[k - 1]).
+ */
+static inline uint64_t popcnt_many(const void* const* bitmaps, int k, uint64_t size, int op)
+{
+  if (k <= 0)
+    return 0;
+  if (k == 1)
+    return popcnt(bitmaps[0], size);
+
+  int cpuid = get_cpuid_flags();
+
+#if defined(LIBPOPCNT_HAVE_AVX512)
+  if ((cpuid & LIBPOPCNT_BIT_AVX512_VPOPCNTDQ) &&
+      size >= 40)
+    return popcnt_many_avx512(bitmaps, k, size, op);
+#endif
+
+#if defined(LIBPOPCNT_HAVE_AVX2)
+  if ((cpuid & LIBPOPCNT_BIT_AVX2) &&
+      size >= 64)
+    return popcnt_many_avx2(bitmaps, k, size, op);
+#endif
+
+  return popcnt_many_u64(bitmaps, k, 0, size, op, cpuid);
+}
+
+/*
+ * Count the number of 1 bits in
+ * (bitmaps[0] AND ... AND bitmaps[k - 1]), i.e. the
+ * cardinality of the intersection of k bitmaps.
+ * The bitmaps are read only once, no temporary
+ * bitmaps are allocated.
+ * @bitmaps: Array of k bitmaps
+ * @size: Size of each bitmap in bytes
+ */
+static inline uint64_t popcnt_and_many(const void* const* bitmaps, int k, uint64_t size)
+{
+  return popcnt_many(bitmaps, k, size, LIBPOPCNT_OP_AND);
+}
+
+/* Cardinality of the union of k bitmaps */
+static inline uint64_t popcnt_or_many(const void* const* bitmaps, int k, uint64_t size)
+{
+  return popcnt_many(bitmaps, k, size, LIBPOPCNT_OP_OR);
+}
+
+/* Count the number of 1 bits in (bitmaps[0] XOR ... XOR bitmaps[k - 1]) */
+static inline uint64_t popcnt_xor_many(const void* const* bitmaps, int k, uint64_t size)
+{
+  return popcnt_many(bitmaps, k, size, LIBPOPCNT_OP_XOR);
+}
+
+/* Number of bit planes needed to count up to n */
+static inline int popcnt_vertical_planes(int n)
+{
+  int planes_n = 0;
+
+  for (; n > 0; n >>= 1)
+    planes_n++;
+
+  return planes_n;
+}
+
+static inline uint64_t popcnt_vertical_impl(const void* const* bitmaps,
+                                            int n,
+                                            uint64_t size,
+                                            uint8_t* planes,
+                                            int m,
+                                            uint8_t* out)
+{
+  int planes_n = popcnt_vertical_planes(n);
+  int cpuid = get_cpuid_flags();
+  uint64_t cnt = 0;
+  uint64_t i = 0;
+
+#if defined(LIBPOPCNT_HAVE_AVX512)
+  if (cpuid & LIBPOPCNT_BIT_AVX512_VPOPCNTDQ)
+  {
+    i = size - size % 64;
+    cnt += popcnt_vertical_avx512(bitmaps, n, planes_n, i, size, planes, m, out);
+  }
+#endif
+
+#if defined(LIBPOPCNT_HAVE_AVX2)
+  if ((cpuid & LIBPOPCNT_BIT_AVX2) &&
+      i == 0)
+  {
+    i = size - size % 32;
+    cnt += popcnt_vertical_avx2(bitmaps, n, planes_n, i, size, planes, m, out);
+  }
+#endif
+
+  return cnt + popcnt_vertical_u64(bitmaps, n, planes_n, i, size, planes, m, out, cpuid);
+}
+
+/*
+ * Vertical popcount: for each bit position count how many
+ * of the n bitmaps have that bit set. The counts are stored
+ * bit-sliced, i.e. bit j of the count of bit position x is
+ * stored in bit x of the bit plane j. This uses
+ * popcnt_vertical_planes(n) bitmaps instead of one byte or
+ * one integer per bit position.
+ * @bitmaps: Array of n bitmaps
+ * @size: Size of each bitmap in bytes
+ * @planes: Output, popcnt_vertical_planes(n) * size bytes,
+ *          bit plane j is stored at &planes[j * size]
+ */
+static inline void popcnt_vertical(const void* const* bitmaps, int n, uint64_t size, void* planes)
+{
+  if (n > 0)
+    popcnt_vertical_impl(bitmaps, n, size, (uint8_t*) planes, 0, NULL);
+}
+
+/*
+ * Threshold query: count the bit positions that are set
+ * in at least m of the n bitmaps.
+ * @bitmaps: Array of n bitmaps
+ * @size: Size of each bitmap in bytes
+ * @out: If not NULL, the bitmap of the bit positions that
+ *       are set in at least m bitmaps (size bytes)
+ */
+static inline uint64_t popcnt_at_least(const void* const* bitmaps, int n, uint64_t size, int m, void* out)
+{
+  if (m <= 0)
+  {
+    if (out)
+      memset(out, 0xff, size);
+    return size * 8;
+  }
+
+  if (m > n)
+  {
+    if (out)
+      memset(out, 0, size);
+    return 0;
+  }
+
+  return popcnt_vertical_impl(bitmaps, n, size, NULL, m, (uint8_t*) out);
+}
+
+/*
+ * Count the number of 1 bits in x ^ (x << 1) where x is the
+ * bitmap data[0], ..., data[size - 1] (bit 0 of data[0] is
+ * the first bit), i.e. the number of positions where the
+ * bitmap changes from 0 to 1 or from 1 to 0. The bit before
+ * the first bit of the bitmap is treated as 0.
+ * @data: A bitmap
+ * @size: Size of data in bytes
+ */
+static inline uint64_t popcnt_transitions(const void* data, uint64_t size)
+{
+  const uint8_t* ptr = (const uint8_t*) data;
+  int cpuid = get_cpuid_flags();
+  uint64_t cnt = 0;
+  uint64_t i = 0;
+
+  /* The vector algorithms read the carry bits from ptr[i - 8] */
+  if (size >= 8)
+  {
+    uint64_t x = load64(ptr);
+    cnt += popcnt64_cpuid(x ^ (x << 1), cpuid);
+    i = 8;
+  }
+
+#if defined(LIBPOPCNT_HAVE_AVX512)
+  if ((cpuid & LIBPOPCNT_BIT_AVX512_VPOPCNTDQ) &&
+      i + 64 <= size)
+  {
+    uint64_t limit = size - (size - i) % 64;
+    cnt += popcnt_transitions_avx512(ptr, i, limit);
+    i = limit;
+  }
+#endif
+
+#if defined(LIBPOPCNT_HAVE_AVX2)
+  if ((cpuid & LIBPOPCNT_BIT_AVX2) &&
+      i + 32 <= size)
+  {
+    uint64_t limit = size - (size - i) % 32;
+    cnt += popcnt_transitions_avx2(ptr, i, limit);
+    i = limit;
+  }
+#endif
+
+#if defined(LIBPOPCNT_HAVE_NEON)
+  if (i + 16 <= size)
+  {
+    uint64_t limit = size - (size - i) % 16;
+    cnt += popcnt_transitions_neon(ptr, i, limit);
+    i = limit;
+  }
+#endif
+
+  uint64_t carry = (i > 0) ? ptr[i - 1] >> 7 : 0;
+
+  for (; i + 8 <= size; i += 8)
+  {
+    uint64_t x = load64(&ptr[i]);
+    cnt += popcnt64_cpuid(x ^ ((x << 1) | carry), cpuid);
+    carry = x >> 63;
+  }
+
+  /* The last bit must not be shifted past the end of the bitmap */
+  if (i < size)
+  {
+    uint64_t bytes = size - i;
+    uint64_t mask = 0xffffffffffffffffull >> (64 - bytes * 8);
+    uint64_t x = load64_partial(&ptr[i], bytes);
+    cnt += popcnt64_cpuid((x ^ ((x << 1) | carry)) & mask, cpuid);
+  }
+
+  return cnt;
+}
+
+/*
+ * Count the number of runs of consecutive 1 bits in
+ * the bitmap, e.g. to choose between a run-length
+ * and a dense bitmap encoding.
+ * @data: A bitmap
+ * @size: Size of data in bytes
+ */
+static inline uint64_t popcnt_runs(const void* data, uint64_t size)
+{
+  if (size == 0)
+    return 0;
+
+  /* Each run has a 0 -> 1 and a 1 -> 0 transition,
+   * except for a run at the end of the bitmap. */
+  uint64_t last = ((const uint8_t*) data)[size - 1] >> 7;
+  return (popcnt_transitions(data, size) + last) / 2;
+}
+
+/*
+ * Decode a bitmap into the indexes of its set bits,
+ * bit j of data[i] has the index i * 8 + j.
+ * Returns the number of set bits, use popcnt(data, size)
+ * to size the out array. The indexes are 32-bit, hence
+ * size must be <= 512 MiB.
+ * @data: A bitmap
+ * @size: Size of data in bytes
+ * @out: Array of popcnt(data, size) indexes (ascending)
+ */
+static inline uint64_t bitmap_decode(const void* data, uint64_t size, uint32_t* out)
+{
+  const uint8_t* ptr = (const uint8_t*) data;
+  uint64_t pos = 0;
+  uint64_t i = 0;
+
+#if defined(LIBPOPCNT_HAVE_AVX512)
+  if (get_cpuid_flags() & LIBPOPCNT_BIT_AVX512_VPOPCNTDQ)
+  {
+    uint64_t words = size / 8;
+    pos = bitmap_decode_avx512(ptr, words, out);
+    i = words * 8;
+  }
+#endif
+
+#if defined(LIBPOPCNT_HAVE_AVX2)
+  /* The AVX2 algorithm writes up to 7 indexes past
+   * the last set bit, it stops 64 entries before
+   * the end of out. */
+  if ((get_cpuid_flags() & LIBPOPCNT_BIT_AVX2) &&
+      i == 0 && size >= 256)
+  {
+    uint64_t words = size / 8;
+    uint64_t total = popcnt(data, size);
+    i = bitmap_decode_avx2(ptr, words, total, &pos, out) * 8;
+  }
+#endif
+
+  return bitmap_decode_u64(ptr, i, size, pos, out);
+}
+
+/*
+ * Find the position of the k-th set bit (k = 0, 1, ...) in
+ * the bitmap, bit j of data[i] has the position i * 8 + j.
+ * Whole blocks are skipped using the vectorized popcount
+ * algorithms, the position within the 64-bit word is found
+ * using PDEP & TZCNT (BMI2) or a portable algorithm.
+ * Returns size * 8 if the bitmap has <= k set bits.
+ * @data: A bitmap
+ * @size: Size of data in bytes
+ */
+static inline uint64_t popcnt_select(const void* data, uint64_t size, uint64_t k)
+{
+  const uint8_t* ptr = (const uint8_t*) data;
+  int cpuid = get_cpuid_flags();
+  uint64_t i = 0;
+
+#if defined(LIBPOPCNT_HAVE_AVX512)
+  if (cpuid & LIBPOPCNT_BIT_AVX512_VPOPCNTDQ)
+    i = popcnt_select_avx512(ptr, size, &k);
+#endif
+
+#if defined(LIBPOPCNT_HAVE_AVX2)
+  if ((cpuid & LIBPOPCNT_BIT_AVX2) &&
+      !(cpuid & LIBPOPCNT_BIT_AVX512_VPOPCNTDQ))
+    i = popcnt_select_avx2(ptr, size, &k);
+#endif
+
+  for (; i < size; i += 8)
+  {
+    uint64_t bytes = (size - i < 8) ? size - i : 8;
+    uint64_t x = (bytes == 8) ? load64(&ptr[i]) : load64_partial(&ptr[i], bytes);
+    uint64_t cnt = popcnt64_cpuid(x, cpuid);
+
+    if (cnt > k)
+    {
+#if defined(LIBPOPCNT_HAVE_AVX2)
+      if (cpuid & LIBPOPCNT_BIT_BMI2)
+        return i * 8 + select64_bmi2(x, k);
+#endif
+      return i * 8 + select64(x, k, cpuid);
+    }
+
+    k -= cnt;
+  }
+
+  return size * 8;
+}
+
+/*
+ * Masked popcount of many columns, i.e. count the 1 bits of
+ * each column restricted to the selection mask. The mask
+ * is read only once for all columns.
+ * @mask: The selection bitmap
+ * @columns: Array of n bitmaps
+ * @size: Size of mask and of each column in bytes
+ * @out: out[j] = popcnt(mask AND columns[j])
+ */
+static inline void popcnt_masked(const void* mask, const void* const* columns, int n, uint64_t size, uint64_t* out)
+{
+  const uint8_t* mask8 = (const uint8_t*) mask;
+  int cpuid = get_cpuid_flags();
+
+  for (int j = 0; j < n; j++)
+    out[j] = 0;
+
+  if (n <= 0)
+    return;
+
+#if defined(LIBPOPCNT_HAVE_AVX512)
+  if (cpuid & LIBPOPCNT_BIT_AVX512_VPOPCNTDQ)
+  {
+    popcnt_masked_avx512(mask8, columns, n, size, out);
+    return;
+  }
+#endif
+
+#if defined(LIBPOPCNT_HAVE_AVX2)
+  if (cpuid & LIBPOPCNT_BIT_AVX2)
+  {
+    popcnt_masked_avx2(mask8, columns, n, size, out);
+    return;
+  }
+#endif
+
+  for (int j = 0; j < n; j++)
+    out[j] = popcnt_op_u64(mask8, (const uint8_t*) columns[j], size, LIBPOPCNT_OP_AND, cpuid);
+}
+
+/*
+ * Count the number of 1 bits in (data AND mask).
+ * @data: An array
+ * @mask: An array
+ * @size: Size of data and mask in bytes
+ */
+static inline uint64_t popcnt_and(const void* data, const void* mask, uint64_t size)
+{
+  const uint8_t* data8 = (const uint8_t*) data;
+  const uint8_t* mask8 = (const uint8_t*) mask;
+  int cpuid = get_cpuid_flags();
+
+#if defined(LIBPOPCNT_HAVE_AVX512)
+  /* For tiny arrays AVX512 is not worth it */
+  if ((cpuid & LIBPOPCNT_BIT_AVX512_VPOPCNTDQ) &&
+      size >= 40)
+    return popcnt_and_avx512(data8, mask8, size);
+#endif
+
+#if defined(LIBPOPCNT_HAVE_AVX2)
+  /* AVX2 requires arrays >= 512 bytes */
+  if ((cpuid & LIBPOPCNT_BIT_AVX2) &&
+      size >= 512)
+    return popcnt_and_avx2(data8, mask8, size);
+#endif
+
+  return popcnt_op_u64(data8, mask8, size, LIBPOPCNT_OP_AND, cpuid);
+}
+
+/*
+ * dst = dst op src for n blocks of 512 bytes, the 1 bits
+ * of each resulting block are counted in the same pass.
+ * Used by libpopcnt::bitset for bulk operations.
+ * @counts: counts[b] = popcnt of block b of dst
+ */
+static inline void popcnt_op_blocks(void* dst, const void* src, uint64_t n, int op, uint64_t* counts)
+{
+  uint8_t* dst8 = (uint8_t*) dst;
+  const uint8_t* src8 = (const uint8_t*) src;
+  int cpuid = get_cpuid_flags();
+
+#if defined(LIBPOPCNT_HAVE_AVX512)
+  if (cpuid & LIBPOPCNT_BIT_AVX512_VPOPCNTDQ)
+  {
+    popcnt_op_blocks_avx512(dst8, src8, n, op, counts);
+    return;
+  }
+#endif
+
+#if defined(LIBPOPCNT_HAVE_AVX2)
+  if (cpuid & LIBPOPCNT_BIT_AVX2)
+  {
+    popcnt_op_blocks_avx2(dst8, src8, n, op, counts);
+    return;
+  }
+#endif
+
+  for (uint64_t b = 0; b < n; b++)
+  {
+    uint64_t cnt = 0;
+
+    for (uint64_t i = b * 512; i < (b + 1) * 512; i += 8)
+    {
+      uint64_t x = combine64(load64(&dst8[i]), load64(&src8[i]), op);
+      memcpy(&dst8[i], &x, sizeof(x));
+      cnt += popcnt64_cpuid(x, cpuid);
+    }
+
+    counts[b] = cnt;
+  }
+}
+
+/*
+ * Update the top-k max-heap using the fingerprints
+ * db[first], ..., db[last - 1]. The distances of 8
+ * (AVX512) or 4 (AVX2) fingerprints are computed at
+ * once and only the fingerprints closer than the current
+ * k-th nearest fingerprint are inserted into the heap.
+ */
+static inline void hamming_topk_scan(const uint8_t* query,
+                                     const uint8_t* db,
+                                     uint64_t size,
+                                     uint64_t first,
+                                     uint64_t last,
+                                     uint64_t k,
+                                     uint64_t* indexes,
+                                     uint64_t* distances,
+                                     uint64_t* count)
+{
+  uint64_t i = first;
+
+#if defined(LIBPOPCNT_HAVE_AVX512)
+  if (get_cpuid_flags() & LIBPOPCNT_BIT_AVX512_VPOPCNTDQ)
+  {
+    uint64_t dist[8];
+
+    for (; i + 8 <= last; i += 8)
+    {
+      uint64_t threshold = (*count < k) ? ~0ull : distances[0];
+      int mask = hamming8_filter_avx512(query, &db[i * size], size, threshold, dist);
+
+      for (int r = 0; mask != 0; r++, mask >>= 1)
+        if (mask & 1)
+          topk_push(indexes, distances, count, k, i + r, dist[r]);
+    }
+  }
+#endif
+
+#if defined(LIBPOPCNT_HAVE_AVX2)
+  if (get_cpuid_flags() & LIBPOPCNT_BIT_AVX2)
+  {
+    uint64_t dist[8];
+
+    for (; i + 4 <= last; i += 4)
+    {
+      uint64_t threshold = (*count < k) ? ~0ull : distances[0];
+      int mask = hamming4_filter_avx2(query, &db[i * size], size, threshold, dist);
+
+      for (int r = 0; mask != 0; r++, mask >>= 1)
+        if (mask & 1)
+          topk_push(indexes, distances, count, k, i + r, dist[r]);
+    }
+  }
+#endif
+
+  for (; i < last; i++)
+    topk_push(indexes, distances, count, k, i, popcnt_xor(query, &db[i * size], size));
+}
+
+static inline uint64_t hamming_topk_dispatch(const void* query,
+                                             const void* db,
+                                             uint64_t size,
+                                             uint64_t n,
+                                             uint64_t k,
+                                             uint64_t* indexes,
+                                             uint64_t* distances)
+{
+  const uint8_t* query8 = (const uint8_t*) query;
+  const uint8_t* db8 = (const uint8_t*) db;
+  uint64_t count = 0;
+
+  /* At most n results, this also bounds the buffer size below */
+  k = (k < n) ? k : n;
+  if (k == 0)
+    return 0;
+
+#if defined(_OPENMP)
+  int threads = omp_get_max_threads();
+
+  /* Each thread searches a part of the database using its */
+  /* own heap, then the heaps of all threads are merged. */
+  if (threads > 1 &&
+      !omp_in_parallel() &&
+      n * size >= (1ull << 20) * threads)
+  {
+    uint64_t* buffer = (uint64_t*) malloc(sizeof(uint64_t) * (2 * k + 1) * threads);
+
+    if (buffer)
+    {
+      #pragma omp parallel for num_threads(threads)
+      for (int t = 0; t < threads; t++)
+      {
+        uint64_t* thread_indexes = &buffer[(2 * k + 1) * t];
+        uint64_t* thread_distances = &thread_indexes[k];
+        uint64_t* thread_count = &thread_distances[k];
+        uint64_t first = n / threads * t;
+        uint64_t last = (t + 1 == threads) ? n : first + n / threads;
+
+        *thread_count = 0;
+        hamming_topk_scan(query8, db8, size, first, last, k,
+                          thread_indexes, thread_distances, thread_count);
+      }
+
+      for (int t = 0; t < threads; t++)
+      {
+        uint64_t* thread_indexes = &buffer[(2 * k + 1) * t];
+        uint64_t* thread_distances = &thread_indexes[k];
+        uint64_t thread_count = thread_distances[k];
+
+        for (uint64_t i = 0; i < thread_count; i++)
+          topk_push(indexes, distances, &count, k, thread_indexes[i], thread_distances[i]);
+      }
+
+      free(buffer);
+      topk_sort(indexes, distances, count);
+      return count;
+    }
+  }
+#endif
+
+  hamming_topk_scan(query8, db8, size, 0, n, k, indexes, distances, &count);
+  topk_sort(indexes, distances, count);
+
+  return count;
+}
+
+/*
+ * Find the k fingerprints of the database that have the
+ * smallest Hamming distance to the query fingerprint.
+ * If compiled with OpenMP (e.g. -fopenmp) the database
+ * is searched using multiple threads.
+ * @query: Query fingerprint of size bytes
+ * @db: Array of n fingerprints of size bytes each
+ * @size: Size of each fingerprint in bytes
+ * @n: Number of fingerprints in db
+ * @k: Number of fingerprints to find
+ * @indexes: Output array of min(k, n) indexes into db
+ * @distances: Output array of min(k, n) Hamming distances
+ * @return: min(k, n), the results are sorted by
+ *          ascending distance (and ascending index).
+ */
+static inline uint64_t popcnt_hamming_topk(const void* query,
+                                           const void* db,
+                                           uint64_t size,
+                                           uint64_t n,
+                                           uint64_t k,
+                                           uint64_t* indexes,
+                                           uint64_t* distances)
+{
+  LIBPOPCNT_PROBE2(hamming_topk_entry, n, size);
+  uint64_t count = hamming_topk_dispatch(query, db, size, n, k, indexes, distances);
+  LIBPOPCNT_PROBE1(hamming_topk_exit, count);
+
+  return count;
+}
+
+/*
+ * Find all fingerprints of the database whose Hamming
+ * distance to the query fingerprint is <= radius.
+ * @query: Query fingerprint of size bytes
+ * @db: Array of n fingerprints of size bytes each
+ * @size: Size of each fingerprint in bytes
+ * @n: Number of fingerprints in db
+ * @radius: Maximum Hamming distance
+ * @max_results: Size of the indexes and distances arrays
+ * @indexes: Output array of the matching indexes into db
+ * @distances: Output array of the matching Hamming distances
+ * @return: Number of matching fingerprints, only the first
+ *          max_results matches (in ascending index order)
+ *          are stored in indexes and distances.
+ */
+static inline uint64_t popcnt_hamming_radius(const void* query,
+                                             const void* db,
+                                             uint64_t size,
+                                             uint64_t n,
+                                             uint64_t radius,
+                                             uint64_t max_results,
+                                             uint64_t* indexes,
+                                             uint64_t* distances)
+{
+  const uint8_t* query8 = (const uint8_t*) query;
+  const uint8_t* db8 = (const uint8_t*) db;
+  uint64_t count = 0;
+  uint64_t i = 0;
+
+#if defined(LIBPOPCNT_HAVE_AVX512)
+  if (get_cpuid_flags() & LIBPOPCNT_BIT_AVX512_VPOPCNTDQ)
+  {
+    uint64_t dist[8];
+
+    for (; i + 8 <= n; i += 8)
+    {
+      int mask = hamming8_filter_avx512(query8, &db8[i * size], size, radius, dist);
+
+      for (int r = 0; mask != 0; r++, mask >>= 1)
+      {
+        if (mask & 1)
+        {
+          if (count < max_results)
+          {
+            indexes[count] = i + r;
+            distances[count] = dist[r];
+          }
+          count++;
+        }
+      }
+    }
+  }
+#endif
+
+#if defined(LIBPOPCNT_HAVE_AVX2)
+  if (get_cpuid_flags() & LIBPOPCNT_BIT_AVX2)
+  {
+    uint64_t dist[8];
+
+    for (; i + 4 <= n; i += 4)
+    {
+      int mask = hamming4_filter_avx2(query8, &db8[i * size], size, radius, dist);
+
+      for (int r = 0; mask != 0; r++, mask >>= 1)
+      {
+        if (mask & 1)
+        {
+          if (count < max_results)
+          {
+            indexes[count] = i + r;
+            distances[count] = dist[r];
+          }
+          count++;
+        }
+      }
+    }
+  }
+#endif
+
+  for (; i < n; i++)
+  {
+    uint64_t d = popcnt_xor(query8, &db8[i * size], size);
+
+    if (d <= radius)
+    {
+      if (count < max_results)
+      {
+        indexes[count] = i;
+        distances[count] = d;
+      }
+      count++;
+    }
+  }
+
+  return count;
+}
+
+/*
+ * Count the 1 bits of (query op db[j]) for 0 <= j < n
+ * @out: out[j] = popcnt(query op db[j])
+ */
+static inline void popcnt_op_row(const uint8_t* query,
+                                 const uint8_t* db,
+                                 uint64_t size,
+                                 uint64_t n,
+                                 int op,
+                                 uint64_t* out)
+{
+  uint64_t j = 0;
+  int cpuid = get_cpuid_flags();
+
+#if defined(LIBPOPCNT_HAVE_AVX512)
+  if (cpuid & LIBPOPCNT_BIT_AVX512_VPOPCNTDQ)
+    j = popcnt_op_row_avx512(query, db, size, n, op, out);
+#endif
+
+#if defined(LIBPOPCNT_HAVE_AVX2)
+  if (cpuid & LIBPOPCNT_BIT_AVX2)
+    j += popcnt_op_row_avx2(query, &db[j * size], size, n - j, op, &out[j]);
+#endif
+
+  for (; j < n; j++)
+    out[j] = popcnt_op_u64(query, &db[j * size], size, op, cpuid);
+}
+
+/*
+ * Tile sizes of the distance matrix algorithms. A tile of
+ * queries fits into the L1 cache, a tile of database
+ * fingerprints fits into the L2 cache.
+ */
+#define LIBPOPCNT_TILE_L1 (16 << 10)
+#define LIBPOPCNT_TILE_L2 (256 << 10)
+#define LIBPOPCNT_TILE_MAX 1024
+
+/* Hamming distances of the queries a[q_first, q_last) */
+static inline void hamming_matrix_tile(const uint8_t* a,
+                                       uint64_t q_first,
+                                       uint64_t q_last,
+                                       const uint8_t* b,
+                                       uint64_t m,
+                                       uint64_t size,
+                                       uint64_t dtile,
+                                       uint64_t* hamming)
+{
+  for (uint64_t d_first = 0; d_first < m; d_first += dtile)
+  {
+    uint64_t d_last = (d_first + dtile < m) ? d_first + dtile : m;
+    const uint8_t* db = &b[d_first * size];
+
+    for (uint64_t q = q_first; q < q_last; q++)
+      popcnt_op_row(&a[q * size], db, size, d_last - d_first, LIBPOPCNT_OP_XOR, &hamming[q * m + d_first]);
+  }
+}
+
+/*
+ * Tanimoto similarities of the queries a[q_first, q_last).
+ * b_cnt[j] = popcnt(b[j]) for all m rows of b, if b_cnt is
+ * NULL the rows are counted for each database tile.
+ */
+static inline void tanimoto_matrix_tile(const uint8_t* a,
+                                        uint64_t q_first,
+                                        uint64_t q_last,
+                                        const uint8_t* b,
+                                        const uint64_t* b_cnt,
+                                        uint64_t m,
+                                        uint64_t size,
+                                        uint64_t dtile,
+                                        double* tanimoto)
+{
+  uint64_t cnt[LIBPOPCNT_TILE_MAX];
+  uint64_t a_cnt[LIBPOPCNT_TILE_MAX];
+  uint64_t tile_cnt[LIBPOPCNT_TILE_MAX];
+
+  popcnt_records(&a[q_first * size], size, q_last - q_first, a_cnt);
+
+  for (uint64_t d_first = 0; d_first < m; d_first += dtile)
+  {
+    uint64_t d_last = (d_first + dtile < m) ? d_first + dtile : m;
+    uint64_t d_size = d_last - d_first;
+    const uint8_t* db = &b[d_first * size];
+    const uint64_t* db_cnt = &tile_cnt[0];
+
+    if (b_cnt)
+      db_cnt = &b_cnt[d_first];
+    else
+      popcnt_records(db, size, d_size, tile_cnt);
+
+    for (uint64_t q = q_first; q < q_last; q++)
+    {
+      double* row = &tanimoto[q * m + d_first];
+      popcnt_op_row(&a[q * size], db, size, d_size, LIBPOPCNT_OP_AND, cnt);
+
+      for (uint64_t j = 0; j < d_size; j++)
+      {
+        uint64_t union_cnt = a_cnt[q - q_first] + db_cnt[j] - cnt[j];
+        row[j] = (union_cnt > 0) ? (double) cnt[j] / (double) union_cnt : 1.0;
+      }
+    }
+  }
+}
+
+/*
+ * Computes the distance matrix of the fingerprints a[0], ...,
+ * a[n - 1] and b[0], ..., b[m - 1] tile by tile. Each
+ * database tile is reused for all queries of a query tile.
+ * Either the hamming or the tanimoto matrix is computed.
+ */
+static inline void popcnt_matrix(const uint8_t* a,
+                                 uint64_t n,
+                                 const uint8_t* b,
+                                 uint64_t m,
+                                 uint64_t size,
+                                 uint64_t* hamming,
+                                 double* tanimoto)
+{
+  uint64_t size1 = (size > 0) ? size : 1;
+  uint64_t qtile = LIBPOPCNT_TILE_L1 / size1;
+  uint64_t dtile = LIBPOPCNT_TILE_L2 / size1;
+  qtile = (qtile < 1) ? 1 : qtile;
+  qtile = (qtile > LIBPOPCNT_TILE_MAX) ? LIBPOPCNT_TILE_MAX : qtile;
+  dtile = (dtile < 8) ? 8 : dtile - dtile % 8;
+  dtile = (dtile > LIBPOPCNT_TILE_MAX) ? LIBPOPCNT_TILE_MAX : dtile;
+  int64_t qtiles = (int64_t) ((n + qtile - 1) / qtile);
+  uint64_t* b_cnt = NULL;
+
+  LIBPOPCNT_PROBE2(matrix_entry, n * m, size);
+
+  /* Count the rows of b once instead of once per query tile,
+   * if the allocation fails they are counted for each tile */
+  if (tanimoto && n > 0 && m > 0)
+  {
+    b_cnt = (uint64_t*) malloc(sizeof(uint64_t) * m);
+    if (b_cnt)
+      popcnt_records(b, size, m, b_cnt);
+  }
+
+#if defined(_OPENMP)
+  #pragma omp parallel for schedule(dynamic) if (n * m * size >= (1ull << 22))
+#endif
+  for (int64_t t = 0; t < qtiles; t++)
+  {
+    uint64_t q_first = (uint64_t) t * qtile;
+    uint64_t q_last = (q_first + qtile < n) ? q_first + qtile : n;
+
+    if (hamming)
+      hamming_matrix_tile(a, q_first, q_last, b, m, size, dtile, hamming);
+    else
+      tanimoto_matrix_tile(a, q_first, q_last, b, b_cnt, m, size, dtile, tanimoto);
+  }
+
+  free(b_cnt);
+  LIBPOPCNT_PROBE1(matrix_exit, n * m);
+}
+
+/*
+ * Compute the n x m matrix of Hamming distances between
+ * the fingerprints of a and b. Uses cache tiling, if compiled
+ * with OpenMP (e.g. -fopenmp) multiple threads are used.
+ * @a: Array of n fingerprints of size bytes each
+ * @b: Array of m fingerprints of size bytes each
+ * @size: Size of each fingerprint in bytes
+ * @out: out[i * m + j] = popcnt_xor(a[i], b[j], size)
+ */
+static inline void popcnt_hamming_matrix(const void* a,
+                                         uint64_t n,
+                                         const void* b,
+                                         uint64_t m,
+                                         uint64_t size,
+                                         uint64_t* out)
+{
+  popcnt_matrix((const uint8_t*) a, n, (const uint8_t*) b, m, size, out, NULL);
+}
+
+/*
+ * Compute the n x m matrix of Tanimoto (Jaccard) similarities
+ * |a & b| / |a | b| between the fingerprints of a and b.
+ * The similarity of two empty fingerprints is 1.0.
+ * Uses cache tiling, if compiled with OpenMP
+ * (e.g. -fopenmp) multiple threads are used.
+ * @a: Array of n fingerprints of size bytes each
+ * @b: Array of m fingerprints of size bytes each
+ * @size: Size of each fingerprint in bytes
+ * @out: out[i * m + j] = tanimoto(a[i], b[j])
+ */
+static inline void popcnt_tanimoto_matrix(const void* a,
+                                          uint64_t n,
+                                          const void* b,
+                                          uint64_t m,
+                                          uint64_t size,
+                                          double* out)
+{
+  popcnt_matrix((const uint8_t*) a, n, (const uint8_t*) b, m, size, NULL, out);
+}
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#ifdef __cplusplus
+
+#include <stdexcept>
+#include <vector>
+
+/*
+ * libpopcnt::cached_popcnt is only available if
+ * LIBPOPCNT_CACHED_POPCNT is defined. On Linux it can track
+ * the kernel's soft-dirty page bits, which requires the POSIX
+ * headers below.
+ */
+#if defined(LIBPOPCNT_CACHED_POPCNT) && \
+    defined(__linux__)
+  #define LIBPOPCNT_HAVE_SOFT_DIRTY
+  #include <fcntl.h>
+  #include <pthread.h>
+  #include <unistd.h>
+#endif
+
+#if __has_attribute(target)
+  #define LIBPOPCNT_TARGET_AVX2 __attribute__ ((target ("avx2")))
+  #define LIBPOPCNT_TARGET_AVX512 __attribute__ ((target ("avx512f,avx512bw,avx512vpopcntdq")))
+#else
+  #define LIBPOPCNT_TARGET_AVX2
+  #define LIBPOPCNT_TARGET_AVX512
+#endif
+
+namespace libpopcnt {
+
+/*
+ * Boolean expressions of bitmaps using expression templates,
+ * e.g. popcnt_expr((bits(a) & bits(b)) | (bits(c) & ~bits(d)), size)
+ * counts the 1 bits of the expression in a single pass over
+ * the bitmaps without any temporary bitmaps.
+ *
+ * Each node of the expression tree provides:
+ * leaves: The number of bitmaps (leaf nodes) of the subtree.
+ * table<First>::value: The 8-bit truth table of the subtree when
+ * its bitmaps are the variables First, First + 1, ... of the
+ * VPTERNLOGQ instruction (0xF0, 0xCC, 0xAA).
+ * eval64(), eval256(), eval512(): The value of the subtree at
+ * byte offset i.
+ */
+template <typename D>
+struct expr
+{
+  const D& self() const { return *static_cast<const D*>(this); }
+};
+
+/* Leaf node, a bitmap */
+struct bits : expr<bits>
+{
+  enum { leaves = 1 };
+
+  template <int First>
+  struct table { enum { value = (First == 0) ? 0xF0 : (First == 1) ? 0xCC : 0xAA }; };
+
+  explicit bits(const void* data) : ptr((const uint8_t*) data) { }
+
+  uint64_t eval64(uint64_t i) const { return load64(&ptr[i]); }
+  uint64_t eval64_partial(uint64_t i, uint64_t bytes) const { return load64_partial(&ptr[i], bytes); }
+
+#if defined(LIBPOPCNT_HAVE_AVX2)
+  LIBPOPCNT_TARGET_AVX2
+  __m256i eval256(uint64_t i) const { return _mm256_loadu_si256((const __m256i*) &ptr[i]); }
+#endif
+
+#if defined(LIBPOPCNT_HAVE_AVX512)
+  LIBPOPCNT_TARGET_AVX512
+  __m512i eval512(uint64_t i, __mmask64 mask) const { return _mm512_maskz_loadu_epi8(mask, &ptr[i]); }
+
+  LIBPOPCNT_TARGET_AVX512
+  void load512(__m512i* v, uint64_t i, __mmask64 mask) const { v[0] = eval512(i, mask); }
+#endif
+
+  const uint8_t* ptr;
+};
+
+#if defined(LIBPOPCNT_HAVE_AVX512)
+
+/*
+ * Subtrees with up to 3 bitmaps are computed
+ * using a single VPTERNLOGQ instruction.
+ */
+template <typename E>
+LIBPOPCNT_TARGET_AVX512
+inline __m512i ternlog512(const E& e, uint64_t i, __mmask64 mask)
+{
+  __m512i v[(E::leaves > 3) ? E::leaves : 3];
+  v[1] = _mm512_setzero_si512();
+  v[2] = _mm512_setzero_si512();
+  e.load512(v, i, mask);
+  return _mm512_ternarylogic_epi64(v[0], v[1], v[2], E::template table<0>::value);
+}
+
+#endif
+
+/* a & b, a | b, a ^ b */
+template <int Op, typename L, typename R>
+struct binary : expr<binary<Op, L, R> >
+{
+  enum { leaves = L::leaves + R::leaves };
+
+  template <int First>
+  struct table
+  {
+    enum
+    {
+      l = L::template table<First>::value,
+      r = R::template table<First + L::leaves>::value,
+      value = (Op == LIBPOPCNT_OP_XOR) ? (l ^ r) : (Op == LIBPOPCNT_OP_AND) ? (l & r) : (l | r)
+    };
+  };
+
+  binary(const L& l, const R& r) : left(l), right(r) { }
+
+  uint64_t eval64(uint64_t i) const
+  {
+    return combine64(left.eval64(i), right.eval64(i), Op);
+  }
+
+  uint64_t eval64_partial(uint64_t i, uint64_t bytes) const
+  {
+    return combine64(left.eval64_partial(i, bytes), right.eval64_partial(i, bytes), Op);
+  }
+
+#if defined(LIBPOPCNT_HAVE_AVX2)
+  LIBPOPCNT_TARGET_AVX2
+  __m256i eval256(uint64_t i) const
+  {
+    return combine256(left.eval256(i), right.eval256(i), Op);
+  }
+#endif
+
+#if defined(LIBPOPCNT_HAVE_AVX512)
+  LIBPOPCNT_TARGET_AVX512
+  __m512i eval512(uint64_t i, __mmask64 mask) const
+  {
+    if (leaves <= 3)
+      return ternlog512(*this, i, mask);
+    return combine512(left.eval512(i, mask), right.eval512(i, mask), Op);
+  }
+
+  LIBPOPCNT_TARGET_AVX512
+  void load512(__m512i* v, uint64_t i, __mmask64 mask) const
+  {
+    left.load512(v, i, mask);
+    right.load512(v + L::leaves, i, mask);
+  }
+#endif
+
+  L left;
+  R right;
+};
+
+/* ~a */
+template <typename E>
+struct negation : expr<negation<E> >
+{
+  enum { leaves = E::leaves };
+
+  template <int First>
+  struct table { enum { value = 0xFF & ~E::template table<First>::value }; };
+
+  explicit negation(const E& e) : child(e) { }
+
+  uint64_t eval64(uint64_t i) const { return ~child.eval64(i); }
+  uint64_t eval64_partial(uint64_t i, uint64_t bytes) const { return ~child.eval64_partial(i, bytes); }
+
+#if defined(LIBPOPCNT_HAVE_AVX2)
+  LIBPOPCNT_TARGET_AVX2
+  __m256i eval256(uint64_t i) const
+  {
+    return _mm256_xor_si256(child.eval256(i), _mm256_set1_epi64x(-1));
+  }
+#endif
+
+#if defined(LIBPOPCNT_HAVE_AVX512)
+  LIBPOPCNT_TARGET_AVX512
+  __m512i eval512(uint64_t i, __mmask64 mask) const
+  {
+    if (leaves <= 3)
+      return ternlog512(*this, i, mask);
+    __m512i vec = child.eval512(i, mask);
+    return _mm512_ternarylogic_epi64(vec, vec, vec, 0x0F);
+  }
+
+  LIBPOPCNT_TARGET_AVX512
+  void load512(__m512i* v, uint64_t i, __mmask64 mask) const { child.load512(v, i, mask); }
+#endif
+
+  E child;
+};
+
+template <typename L, typename R>
+inline binary<LIBPOPCNT_OP_AND, L, R> operator&(const expr<L>& l, const expr<R>& r)
+{
+  return binary<LIBPOPCNT_OP_AND, L, R>(l.self(), r.self());
+}
+
+template <typename L, typename R>
+inline binary<LIBPOPCNT_OP_OR, L, R> operator|(const expr<L>& l, const expr<R>& r)
+{
+  return binary<LIBPOPCNT_OP_OR, L, R>(l.self(), r.self());
+}
+
+template <typename L, typename R>
+inline binary<LIBPOPCNT_OP_XOR, L, R> operator^(const expr<L>& l, const expr<R>& r)
+{
+  return binary<LIBPOPCNT_OP_XOR, L, R>(l.self(), r.self());
+}
+
+template <typename E>
+inline negation<E> operator~(const expr<E>& e)
+{
+  return negation<E>(e.self());
+}
+
+/*
+ * Count the 1 bits of the expression starting at byte
+ * offset i using the portable 64-bit popcount algorithm.
+ */
+template <typename E>
+inline uint64_t popcnt_expr_u64(const E& e, uint64_t i, uint64_t size, int cpuid)
+{
+  uint64_t cnt = 0;
+
+  for (; i + 8 <= size; i += 8)
+    cnt += popcnt64_cpuid(e.eval64(i), cpuid);
+
+  /* Clear the bits after the end of the bitmaps, ~0 bits
+   * would otherwise be counted for negated bitmaps. */
+  if (i < size)
+  {
+    uint64_t bytes = size - i;
+    uint64_t mask = 0xffffffffffffffffull >> (64 - bytes * 8);
+    cnt += popcnt64_cpuid(e.eval64_partial(i, bytes) & mask, cpuid);
+  }
+
+  return cnt;
+}
+
+#if defined(LIBPOPCNT_HAVE_AVX2)
+
+/* AVX2 Harley-Seal popcount of the expression */
+template <typename E>
+LIBPOPCNT_TARGET_AVX2
+inline uint64_t popcnt_expr_avx2(const E& e, uint64_t size)
+{
+  uint64_t i = 0;
+  libpopcnt_hs256 hs;
+  __m256i v[16];
+
+  hs256_init(&hs);
+
+  for (; i + 512 <= size; i += 512)
+  {
+    for (int j = 0; j < 16; j++)
+      v[j] = e.eval256(i + j * 32);
+    hs256_add16(&hs, v);
+  }
+
+  for (; i + 32 <= size; i += 32)
+    hs256_add(&hs, e.eval256(i));
+
+  return hs256_sum(&hs) + popcnt_expr_u64(e, i, size, LIBPOPCNT_BIT_POPCNT);
+}
+
+#endif
+
+#if defined(LIBPOPCNT_HAVE_AVX512)
+
+/* AVX512 popcount of the expression */
+template <typename E>
+LIBPOPCNT_TARGET_AVX512
+inline uint64_t popcnt_expr_avx512(const E& e, uint64_t size)
+{
+  __m512i cnt0 = _mm512_setzero_si512();
+  __m512i cnt1 = _mm512_setzero_si512();
+  __mmask64 all = (__mmask64) 0xffffffffffffffffull;
+  uint64_t i = 0;
+
+  for (; i + 128 <= size; i += 128)
+  {
+    __m512i vec0 = e.eval512(i + 0, all);
+    __m512i vec1 = e.eval512(i + 64, all);
+    cnt0 = _mm512_add_epi64(cnt0, _mm512_popcnt_epi64(vec0));
+    cnt1 = _mm512_add_epi64(cnt1, _mm512_popcnt_epi64(vec1));
+  }
+
+  /* Process last 127 bytes, the bits after
+   * the end of the bitmaps are cleared. */
+  for (; i < size; i += 64)
+  {
+    __mmask64 mask = (__mmask64) (0xffffffffffffffffull >> ((i + 64 <= size) ? 0 : i + 64 - size));
+    __m512i vec = _mm512_maskz_mov_epi8(mask, e.eval512(i, mask));
+    cnt0 = _mm512_add_epi64(cnt0, _mm512_popcnt_epi64(vec));
+  }
+
+  return _mm512_reduce_add_epi64(_mm512_add_epi64(cnt0, cnt1));
+}
+
+#endif
+
+/*
+ * Count the number of 1 bits of a boolean expression
+ * of bitmaps of size bytes each, e.g.
+ * popcnt_expr((bits(a) & bits(b)) | (bits(c) & ~bits(d)), size).
+ * The expression is evaluated vector by vector in a single
+ * pass over the bitmaps, on AVX512 CPUs subexpressions of
+ * up to 3 bitmaps are computed using VPTERNLOGQ.
+ */
+template <typename E>
+inline uint64_t popcnt_expr(const expr<E>& expression, uint64_t size)
+{
+  const E& e = expression.self();
+  int cpuid = get_cpuid_flags();
+
+#if defined(LIBPOPCNT_HAVE_AVX512)
+  if ((cpuid & LIBPOPCNT_BIT_AVX512_VPOPCNTDQ) &&
+      size >= 40)
+    return popcnt_expr_avx512(e, size);
+#endif
+
+#if defined(LIBPOPCNT_HAVE_AVX2)
+  if ((cpuid & LIBPOPCNT_BIT_AVX2) &&
+      size >= 64)
+    return popcnt_expr_avx2(e, size);
+#endif
+
+  return popcnt_expr_u64(e, 0, size, cpuid);
+}
+
+/*
+ * Dynamic bitset that maintains its number of 1 bits. The bits
+ * are divided into blocks of 4096 bits, a Fenwick tree over the
+ * block counts allows updating single bits in O(log n) and
+ * rank & select queries in O(log n + block size). The block
+ * counts are computed using the vectorized algorithms, bulk
+ * operations count the resulting blocks in the same pass.
+ */
+class bitset
+{
+public:
+  explicit bitset(uint64_t size = 0)
+    : size_(size),
+      count_(0),
+      words_(blocks(size) * block_words, 0),
+      tree_(blocks(size) + 1, 0)
+  { }
+
+  /* Copy the first size bits of data */
+  bitset(const void* data, uint64_t size)
+    : size_(size),
+      count_(0),
+      words_(blocks(size) * block_words, 0),
+      tree_(blocks(size) + 1, 0)
+  {
+    if (size > 0)
+    {
+      memcpy(&words_[0], data, (size + 7) / 8);
+      if (size % 8)
+        ((uint8_t*) &words_[0])[size / 8] &= (uint8_t) ((1u << (size % 8)) - 1);
+    }
+
+    std::vector<uint64_t> counts(blocks(size));
+    if (!counts.empty())
+      popcnt_records(&words_[0], block_words * 8, counts.size(), &counts[0]);
+    build(counts);
+  }
+
+  uint64_t size() const { return size_; }
+
+  /* Number of 1 bits, O(1) */
+  uint64_t count() const { return count_; }
+
+  bool test(uint64_t i) const
+  {
+    return (words_[i / 64] >> (i % 64)) & 1;
+  }
+
+  void set(uint64_t i, bool value = true)
+  {
+    if (test(i) != value)
+      flip(i);
+  }
+
+  void reset(uint64_t i)
+  {
+    set(i, false);
   }
 
-  return cnt;
-#endif
-}
+  void flip(uint64_t i)
+  {
+    words_[i / 64] ^= 1ull << (i % 64);
+    if (test(i))
+      update(i / block_bits, 1);
+    else
+      update(i / block_bits, -1);
+  }
 
-/* Compile with e.g. -march=armv8-a+sve to enable ARM SVE */
-#elif defined(__ARM_FEATURE_SVE) && \
-      __has_include(<arm_sve.h>)
+  /* Number of 1 bits in [0, i) */
+  uint64_t rank(uint64_t i) const
+  {
+    uint64_t block = i / block_bits;
+    uint64_t cnt = 0;
 
-#include <arm_sve.h>
+    for (uint64_t j = block; j > 0; j -= j & (0 - j))
+      cnt += tree_[j];
 
-/*
- * Count the number of 1 bits in the data array
- * @data: An array
- * @size: Size of data in bytes
- */
-static inline uint64_t popcnt(const void* data, uint64_t size)
-{
-  uint64_t i = 0;
-  const uint64_t* ptr64 = (const uint64_t*) data;
-  uint64_t size64 = size / sizeof(uint64_t);
-  svuint64_t vcnt = svdup_u64(0);
+    /* i may be size(), then block can be past the last word */
+    uint64_t bits = i % block_bits;
+    if (bits == 0)
+      return cnt;
 
-  for (; i + svcntd() * 4 <= size64; i += svcntd() * 4)
+    const uint64_t* words = &words_[block * block_words];
+    cnt += popcnt(words, (bits / 64) * 8);
+
+    if (bits % 64)
+      cnt += popcnt64_bitwise(words[bits / 64] & ((1ull << (bits % 64)) - 1));
+
+    return cnt;
+  }
+
+  /* Position of the k-th 1 bit (k = 0, 1, ...), size() if k >= count() */
+  uint64_t select(uint64_t k) const
   {
-    svuint64_t vec0 = svld1_u64(svptrue_b64(), &ptr64[i + svcntd() * 0]);
-    svuint64_t vec1 = svld1_u64(svptrue_b64(), &ptr64[i + svcntd() * 1]);
-    svuint64_t vec2 = svld1_u64(svptrue_b64(), &ptr64[i + svcntd() * 2]);
-    svuint64_t vec3 = svld1_u64(svptrue_b64(), &ptr64[i + svcntd() * 3]);
+    if (k >= count_)
+      return size_;
 
-    vec0 = svcnt_u64_x(svptrue_b64(), vec0);
-    vec1 = svcnt_u64_x(svptrue_b64(), vec1);
-    vec2 = svcnt_u64_x(svptrue_b64(), vec2);
-    vec3 = svcnt_u64_x(svptrue_b64(), vec3);
+    /* Fenwick tree search for the block */
+    uint64_t block = 0;
+    uint64_t n = tree_.size() - 1;
+    uint64_t step = 1;
 
-    vcnt = svadd_u64_x(svptrue_b64(), vcnt, vec0);
-    vcnt = svadd_u64_x(svptrue_b64(), vcnt, vec1);
-    vcnt = svadd_u64_x(svptrue_b64(), vcnt, vec2);
-    vcnt = svadd_u64_x(svptrue_b64(), vcnt, vec3);
+    while (step * 2 <= n)
+      step *= 2;
+
+    for (; step > 0; step /= 2)
+    {
+      if (block + step <= n && tree_[block + step] <= k)
+      {
+        block += step;
+        k -= tree_[block];
+      }
+    }
+
+    return block * block_bits + popcnt_select(&words_[block * block_words], block_words * 8, k);
   }
 
-  svbool_t pg = svwhilelt_b64(i, size64);
+  bitset& operator&=(const bitset& other) { return bulk(other, LIBPOPCNT_OP_AND); }
+  bitset& operator|=(const bitset& other) { return bulk(other, LIBPOPCNT_OP_OR); }
+  bitset& operator^=(const bitset& other) { return bulk(other, LIBPOPCNT_OP_XOR); }
 
-  while (svptest_any(svptrue_b64(), pg))
+  /* The bits, the unused bits of the last block are 0 */
+  const uint64_t* data() const { return words_.empty() ? NULL : &words_[0]; }
+
+private:
+  enum { block_bits = 4096, block_words = block_bits / 64 };
+
+  static uint64_t blocks(uint64_t size)
   {
-    svuint64_t vec = svld1_u64(pg, &ptr64[i]);
-    vec = svcnt_u64_z(pg, vec);
-    vcnt = svadd_u64_x(svptrue_b64(), vcnt, vec);
-    i += svcntd();
-    pg = svwhilelt_b64(i, size64);
+    return (size + block_bits - 1) / block_bits;
   }
 
-  uint64_t cnt = svaddv_u64(svptrue_b64(), vcnt);
-  uint64_t bytes = size % sizeof(uint64_t);
+  /* Add delta to the count of the block */
+  void update(uint64_t block, int delta)
+  {
+    for (uint64_t j = block + 1; j < tree_.size(); j += j & (0 - j))
+      tree_[j] += (uint64_t) (int64_t) delta;
+    count_ += (uint64_t) (int64_t) delta;
+  }
 
-  if (bytes != 0)
+  /* Build the Fenwick tree from the block counts in O(n) */
+  void build(const std::vector<uint64_t>& counts)
   {
-    i = size - bytes;
-    const uint8_t* ptr8 = (const uint8_t*) data;
-    svbool_t pg8 = svwhilelt_b8(i, size);
-    svuint8_t vec = svld1_u8(pg8, &ptr8[i]);
-    svuint8_t vcnt8 = svcnt_u8_z(pg8, vec);
-    cnt += svaddv_u8(pg8, vcnt8);
+    count_ = 0;
+
+    for (uint64_t j = 1; j < tree_.size(); j++)
+    {
+      tree_[j] = counts[j - 1];
+      count_ += counts[j - 1];
+    }
+
+    for (uint64_t j = 1; j < tree_.size(); j++)
+    {
+      uint64_t parent = j + (j & (0 - j));
+      if (parent < tree_.size())
+        tree_[parent] += tree_[j];
+    }
   }
 
-  return cnt;
-}
+  bitset& bulk(const bitset& other, int op)
+  {
+    if (size_ != other.size_)
+      throw std::invalid_argument("libpopcnt::bitset: bitsets must have the same size");
 
-#elif (defined(__ARM_NEON) || \
-       defined(__aarch64__) || \
-       defined(_M_ARM64)) && \
-      __has_include(<arm_neon.h>)
+    std::vector<uint64_t> counts(blocks(size_));
+    if (!counts.empty())
+      popcnt_op_blocks(&words_[0], &other.words_[0], counts.size(), op, &counts[0]);
+    build(counts);
 
-#include <arm_neon.h>
+    return *this;
+  }
 
-static inline uint64x2_t vpadalq(uint64x2_t sum, uint8x16_t t)
-{
-  return vpadalq_u32(sum, vpaddlq_u16(vpaddlq_u8(t)));
-}
+  uint64_t size_;
+  uint64_t count_;
+  std::vector<uint64_t> words_;
+  std::vector<uint64_t> tree_;
+};
+
+#if defined(LIBPOPCNT_CACHED_POPCNT)
 
 /*
- * Count the number of 1 bits in the data array
- * @data: An array
- * @size: Size of data in bytes
+ * Counts the 1 bits of a buffer that changes slowly, the counts
+ * of its pages are cached and only the pages marked dirty are
+ * recounted. Pages are marked dirty using mark_dirty() or on
+ * Linux using the kernel's soft-dirty page bits, see
+ * track_soft_dirty(). The buffer must not be modified while
+ * count() is running. Requires LIBPOPCNT_CACHED_POPCNT.
  */
-static inline uint64_t popcnt(const void* data, uint64_t size)
+class cached_popcnt
 {
-  uint64_t i = 0;
-  uint64_t cnt = 0;
-  uint64_t chunk_size = 64;
-  const uint8_t* ptr = (const uint8_t*) data;
+public:
+  cached_popcnt(const void* data, uint64_t size, uint64_t page_size = 4096)
+    : data_((const uint8_t*) data),
+      size_(size),
+      page_size_(page_size),
+      total_(0),
+      counts_((size + page_size - 1) / page_size),
+      dirty_((counts_.size() + 63) / 64, 0),
+      soft_dirty_(false),
+      next_(0)
+  {
+    for (uint64_t p = 0; p < counts_.size(); p++)
+    {
+      counts_[p] = popcnt(&data_[p * page_size_], page_bytes(p));
+      total_ += counts_[p];
+    }
+  }
 
-  if (size >= chunk_size)
+  ~cached_popcnt()
   {
-    uint64_t iters = size / chunk_size;
-    uint64x2_t sum = vcombine_u64(vcreate_u64(0), vcreate_u64(0));
-    uint8x16_t zero = vcombine_u8(vcreate_u8(0), vcreate_u8(0));
+#if defined(LIBPOPCNT_HAVE_SOFT_DIRTY)
+    if (soft_dirty_)
+    {
+      tracker_lock lock;
+      cached_popcnt** p = &tracker().head;
+      while (*p != this)
+        p = &(*p)->next_;
+      *p = next_;
+    }
+#endif
+  }
 
-    do
+  /* Mark the pages of data[offset, offset + size) as dirty */
+  void mark_dirty(uint64_t offset, uint64_t size)
+  {
+#if defined(LIBPOPCNT_HAVE_SOFT_DIRTY)
+    if (soft_dirty_)
     {
-      uint8x16_t t0 = zero;
-      uint8x16_t t1 = zero;
-      uint8x16_t t2 = zero;
-      uint8x16_t t3 = zero;
+      tracker_lock lock;
+      set_dirty(offset, size);
+      return;
+    }
+#endif
+    set_dirty(offset, size);
+  }
 
-      /*
-       * After every 31 iterations we need to add the
-       * temporary sums (t0, t1, t2, t3) to the total sum.
-       * We must ensure that the temporary sums <= 255
-       * and 31 * 8 bits = 248 which is OK.
-       */
-      uint64_t limit = (i + 31 < iters) ? i + 31 : iters;
-  
-      /* Each iteration processes 64 bytes */
-      for (; i < limit; i++)
-      {
-        uint8x16x4_t input = vld4q_u8(ptr);
-        ptr += chunk_size;
+  void mark_all_dirty()
+  {
+    mark_dirty(0, size_);
+  }
 
-        t0 = vaddq_u8(t0, vcntq_u8(input.val[0]));
-        t1 = vaddq_u8(t1, vcntq_u8(input.val[1]));
-        t2 = vaddq_u8(t2, vcntq_u8(input.val[2]));
-        t3 = vaddq_u8(t3, vcntq_u8(input.val[3]));
+  /* Recount the dirty pages, returns the number of 1 bits */
+  uint64_t count()
+  {
+#if defined(LIBPOPCNT_HAVE_SOFT_DIRTY)
+    if (soft_dirty_)
+    {
+      std::vector<uint64_t> dirty(dirty_.size(), 0);
+      {
+        tracker_lock lock;
+        refresh_soft_dirty(this);
+        dirty.swap(dirty_);
       }
+      return recount(dirty);
+    }
+#endif
+    return recount(dirty_);
+  }
 
-      sum = vpadalq(sum, t0);
-      sum = vpadalq(sum, t1);
-      sum = vpadalq(sum, t2);
-      sum = vpadalq(sum, t3);
+  /* Number of pages that will be recounted by count() */
+  uint64_t dirty_pages() const
+  {
+#if defined(LIBPOPCNT_HAVE_SOFT_DIRTY)
+    if (soft_dirty_)
+    {
+      tracker_lock lock;
+      return dirty_.empty() ? 0 : popcnt(&dirty_[0], dirty_.size() * 8);
     }
-    while (i < iters);
+#endif
+    return dirty_.empty() ? 0 : popcnt(&dirty_[0], dirty_.size() * 8);
+  }
 
-    i = 0;
-    size %= chunk_size;
+#if defined(LIBPOPCNT_HAVE_SOFT_DIRTY)
+  /*
+   * Use the soft-dirty bits of /proc/self/pagemap to find the
+   * pages written since the previous count(), call it right
+   * after the constructor. Returns false if the kernel does not
+   * support soft-dirty bits.
+   *
+   * count() clears the soft-dirty bits using
+   * /proc/self/clear_refs, which resets them for the whole
+   * process, including the state of other users of soft-dirty
+   * bits in the same process such as CRIU. A write to the buffer
+   * of another tracking object right before the bits are cleared
+   * cannot be detected, hence count() marks all pages of the
+   * other tracking objects dirty: with n tracking objects each
+   * count() causes n - 1 full recounts. Clearing the bits also
+   * write-protects all pages of the process, the first write to
+   * every page afterwards causes a page fault.
+   */
+  bool track_soft_dirty()
+  {
+    if (soft_dirty_)
+      return true;
+
+    long os_page = sysconf(_SC_PAGESIZE);
+    if (os_page <= 0)
+      return false;
+
+    /* Check that writes set the soft-dirty bit */
+    std::vector<uint8_t> probe((uint64_t) os_page * 2);
+    uintptr_t addr = ((uintptr_t) &probe[0] + os_page - 1) / os_page * os_page;
+    uint64_t entry = 0;
+    tracker_lock lock;
+
+    if (!refresh_soft_dirty(0))
+      return false;
+
+    *(volatile uint8_t*) addr = 1;
+    int fd = open("/proc/self/pagemap", O_RDONLY);
+    if (fd < 0)
+      return false;
+
+    bool ok = read_pagemap(fd, addr / os_page, 1, &entry);
+    close(fd);
+    if (!ok || !(entry & soft_dirty_bit))
+      return false;
+
+    /* Pages written since the bits were cleared are
+     * recounted by the next count() */
+    next_ = tracker().head;
+    tracker().head = this;
+    soft_dirty_ = true;
+
+    return true;
+  }
+#endif
 
-    uint64_t tmp[2];
-    vst1q_u64(tmp, sum);
-    cnt += tmp[0];
-    cnt += tmp[1];
+private:
+  /* Not copyable, the tracker stores pointers to its objects */
+  cached_popcnt(const cached_popcnt&);
+  cached_popcnt& operator=(const cached_popcnt&);
+
+  uint64_t page_bytes(uint64_t p) const
+  {
+    return (p + 1 < counts_.size()) ? page_size_ : size_ - p * page_size_;
   }
 
-  if (i + 8 <= size)
+  void set_dirty(uint64_t offset, uint64_t size)
   {
-    uintptr_t rem = ((uintptr_t) &ptr[i]) % 8;
+    if (size == 0 || offset >= size_)
+      return;
 
-    /* Align &ptr[i] to an 8 byte boundary */
-    if (rem != 0)
-    {
-      uint64_t val = 0;
-      uint64_t bytes = (uint64_t) (8 - rem % 8);
-      bytes = (bytes <= 7) ? bytes : 7;
-      for (uint64_t j = 0; j < bytes; j++)
-        val |= ((uint64_t) ptr[i + j]) << (j * 8);
-      cnt += popcnt64(val);
-      i += bytes;
-    }
+    uint64_t last = (offset + size - 1 < size_) ? offset + size - 1 : size_ - 1;
+    for (uint64_t p = offset / page_size_; p <= last / page_size_; p++)
+      dirty_[p / 64] |= 1ull << (p % 64);
   }
 
-  for (; i + 8 <= size; i += 8)
-    cnt += popcnt64(*(const uint64_t*)(ptr + i));
-
-  if (i < size)
+  uint64_t recount(std::vector<uint64_t>& dirty)
   {
-    uint64_t val = 0;
-    uint64_t bytes = (uint64_t) (size - i);
-    bytes = (bytes <= 7) ? bytes : 7;
-    for (uint64_t j = 0; j < bytes; j++)
-      val |= ((uint64_t) ptr[i + j]) << (j * 8);
-    cnt += popcnt64(val);
+    for (uint64_t i = 0; i < dirty.size(); i++)
+    {
+      for (uint64_t word = dirty[i]; word; word &= word - 1)
+      {
+        uint64_t p = i * 64 + ctz64(word);
+        uint64_t cnt = popcnt(&data_[p * page_size_], page_bytes(p));
+        total_ = total_ - counts_[p] + cnt;
+        counts_[p] = cnt;
+      }
+      dirty[i] = 0;
+    }
+
+    return total_;
   }
 
-  return cnt;
-}
+#if defined(LIBPOPCNT_HAVE_SOFT_DIRTY)
+  static const uint64_t pagemap_entries = 512;
+  static const uint64_t soft_dirty_bit = 1ull << 55;
 
-/* all other CPUs */
-#else
+  /* The objects of the process that track soft-dirty bits */
+  struct soft_dirty_tracker
+  {
+    pthread_mutex_t mutex;
+    cached_popcnt* head;
+  };
 
-/*
- * Count the number of 1 bits in the data array
- * @data: An array
- * @size: Size of data in bytes
- */
-static inline uint64_t popcnt(const void* data, uint64_t size)
-{
-  uint64_t i = 0;
-  uint64_t cnt = 0;
-  const uint8_t* ptr = (const uint8_t*) data;
+  /* Inline member function, one tracker per process */
+  static soft_dirty_tracker& tracker()
+  {
+    static soft_dirty_tracker t = { PTHREAD_MUTEX_INITIALIZER, 0 };
+    return t;
+  }
 
-  if (i + 8 <= size)
+  struct tracker_lock
   {
-    uintptr_t rem = ((uintptr_t) &ptr[i]) % 8;
+    tracker_lock() { pthread_mutex_lock(&tracker().mutex); }
+    ~tracker_lock() { pthread_mutex_unlock(&tracker().mutex); }
+  };
 
-    /* Align &ptr[i] to an 8 byte boundary */
-    if (rem != 0)
+  /*
+   * Mark the soft-dirty pages of self as dirty, then clear the
+   * soft-dirty bits of the whole process. The soft-dirty bits of
+   * the other tracking objects are lost, hence all their pages
+   * are marked dirty. The tracker must be locked.
+   */
+  static bool refresh_soft_dirty(cached_popcnt* self)
+  {
+    if (self)
     {
-      uint64_t val = 0;
-      uint64_t bytes = (uint64_t) (8 - rem % 8);
-      bytes = (bytes <= 7) ? bytes : 7;
-      for (uint64_t j = 0; j < bytes; j++)
-        val |= ((uint64_t) ptr[i + j]) << (j * 8);
-      cnt += popcnt64(val);
-      i += bytes;
+      int fd = open("/proc/self/pagemap", O_RDONLY);
+      if (fd < 0 || !self->mark_soft_dirty(fd))
+        self->set_dirty(0, self->size_);
+      if (fd >= 0)
+        close(fd);
     }
+
+    for (cached_popcnt* c = tracker().head; c; c = c->next_)
+      if (c != self)
+        c->set_dirty(0, c->size_);
+
+    return clear_soft_dirty();
   }
 
-  for (; i + 8 <= size; i += 8)
-    cnt += popcnt64(*(const uint64_t*)(ptr + i));
+  static bool clear_soft_dirty()
+  {
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    if (fd < 0)
+      return false;
 
-  if (i < size)
+    bool ok = write(fd, "4", 1) == 1;
+    close(fd);
+    return ok;
+  }
+
+  /* Read the pagemap entries of the pages [first, first + n) */
+  static bool read_pagemap(int fd, uint64_t first, uint64_t n, uint64_t* entries)
   {
-    uint64_t val = 0;
-    uint64_t bytes = (uint64_t) (size - i);
-    bytes = (bytes <= 7) ? bytes : 7;
-    for (uint64_t j = 0; j < bytes; j++)
-      val |= ((uint64_t) ptr[i + j]) << (j * 8);
-    cnt += popcnt64(val);
+    ssize_t bytes = (ssize_t) (n * sizeof(uint64_t));
+    return pread(fd, entries, bytes, (off_t) (first * sizeof(uint64_t))) == bytes;
   }
 
-  return cnt;
-}
+  /* Mark the soft-dirty pages as dirty, returns false on error */
+  bool mark_soft_dirty(int fd)
+  {
+    if (size_ == 0)
+      return true;
 
-#endif
+    uint64_t os_page = (uint64_t) sysconf(_SC_PAGESIZE);
+    uint64_t first = (uintptr_t) data_ / os_page;
+    uint64_t last = ((uintptr_t) data_ + size_ - 1) / os_page;
+    uint64_t entries[pagemap_entries];
 
-#ifdef __cplusplus
-} /* extern "C" */
+    for (uint64_t i = first; i <= last; i += pagemap_entries)
+    {
+      uint64_t n = (last - i + 1 < pagemap_entries) ? last - i + 1 : pagemap_entries;
+
+      if (!read_pagemap(fd, i, n, entries))
+        return false;
+
+      for (uint64_t j = 0; j < n; j++)
+      {
+        if (entries[j] & soft_dirty_bit)
+        {
+          uintptr_t addr = (uintptr_t) ((i + j) * os_page);
+          uintptr_t begin = (addr > (uintptr_t) data_) ? addr : (uintptr_t) data_;
+          set_dirty(begin - (uintptr_t) data_, addr + os_page - begin);
+        }
+      }
+    }
+
+    return true;
+  }
 #endif
 
+  const uint8_t* data_;
+  uint64_t size_;
+  uint64_t page_size_;
+  uint64_t total_;
+  std::vector<uint64_t> counts_;
+  std::vector<uint64_t> dirty_;
+  bool soft_dirty_;
+  cached_popcnt* next_;
+};
+
+#endif /* LIBPOPCNT_CACHED_POPCNT */
+
+} // namespace libpopcnt
+
+#endif /* __cplusplus */
+
 #endif /* LIBPOPCNT_H */
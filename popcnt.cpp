@@ -0,0 +1,495 @@
+///
+/// @file  popcnt.cpp
+/// @brief Command-line tool that counts the number of 1 bits in
+///        files. The files are split into chunks that are counted
+///        in parallel, either using mmap() or using pread() with
+///        double buffering.
+///
+/// Usage: ./popcnt [options] FILE...
+///
+/// Copyright (C) 2026 Kim Walisch, <kim.walisch@gmail.com>
+///
+/// This file is distributed under the BSD License. See the LICENSE
+/// file in the top level directory.
+///
+
+// Files > 2 GiB on 32-bit Unix
+#if !defined(_FILE_OFFSET_BITS)
+  #define _FILE_OFFSET_BITS 64
+#endif
+
+#include <libpopcnt.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <iomanip>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || \
+    defined(__APPLE__)
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+  #define POPCNT_HAVE_POSIX
+#endif
+
+struct options
+{
+  int threads = 0;
+  bool read = false;
+  bool populate = false;
+  bool sequential = false;
+  bool stats = false;
+  bool sparse = true;
+  uint64_t buffer_size = 4 << 20;
+};
+
+struct file
+{
+  std::string name;
+  uint64_t size = 0;
+  int fd = -1;
+  int error = 0;
+};
+
+/// A region of a file that contains data, i.e. not a hole
+struct extent
+{
+  size_t file;
+  uint64_t offset;
+  uint64_t size;
+};
+
+/// A part of a file that is counted by a single thread
+struct chunk
+{
+  size_t file;
+  uint64_t offset;
+  uint64_t size;
+  uint64_t count;
+  int error;
+};
+
+double get_seconds()
+{
+  auto now = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(now.time_since_epoch()).count();
+}
+
+std::string error_message(int error)
+{
+#if defined(_MSC_VER)
+  // std::strerror() is deprecated by MSVC
+  char buffer[256];
+  strerror_s(buffer, sizeof(buffer), error);
+  return buffer;
+#else
+  return std::strerror(error);
+#endif
+}
+
+/// Open the file and get its size, sets f.error on failure
+void open_file(file& f)
+{
+#if defined(POPCNT_HAVE_POSIX)
+  f.fd = open(f.name.c_str(), O_RDONLY);
+  if (f.fd < 0)
+  {
+    f.error = errno;
+    return;
+  }
+
+  struct stat st;
+  if (fstat(f.fd, &st) != 0)
+    f.error = errno;
+  else if (S_ISDIR(st.st_mode))
+    f.error = EISDIR;
+  else
+  {
+    // Unlike st_size this also works for block devices
+    off_t size = lseek(f.fd, 0, SEEK_END);
+    if (size < 0)
+      f.error = errno;
+    else
+      f.size = (uint64_t) size;
+  }
+#else
+  std::ifstream in(f.name.c_str(), std::ios::binary | std::ios::ate);
+  if (!in)
+    f.error = ENOENT;
+  else
+    f.size = (uint64_t) in.tellg();
+#endif
+}
+
+void close_file(file& f)
+{
+#if defined(POPCNT_HAVE_POSIX)
+  if (f.fd >= 0)
+    close(f.fd);
+  f.fd = -1;
+#endif
+}
+
+/// Read size bytes at offset into buffer.
+/// @return: Number of bytes read or -errno.
+int64_t read_block(const file& f,
+                   uint8_t* buffer,
+                   uint64_t size,
+                   uint64_t offset)
+{
+  uint64_t bytes = 0;
+
+#if defined(POPCNT_HAVE_POSIX)
+  while (bytes < size)
+  {
+    ssize_t n = pread(f.fd, &buffer[bytes], size - bytes, (off_t) (offset + bytes));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return -errno;
+    if (n == 0)
+      break;
+    bytes += (uint64_t) n;
+  }
+#else
+  std::ifstream in(f.name.c_str(), std::ios::binary);
+  in.seekg((std::streamoff) offset);
+  in.read((char*) buffer, (std::streamsize) size);
+  bytes = (uint64_t) in.gcount();
+#endif
+
+  return (int64_t) bytes;
+}
+
+/// Count the chunk using pread(). While the current buffer
+/// is being counted the next block is read into the other
+/// buffer by a helper thread.
+uint64_t count_read(const file& f,
+                    chunk& c,
+                    std::vector<uint8_t>& buffers,
+                    const options& opts)
+{
+  uint64_t bs = opts.buffer_size;
+  uint8_t* buffer[2] = { &buffers[0], &buffers[bs] };
+  uint64_t cnt = 0;
+  uint64_t pos = 0;
+
+  std::future<int64_t> next = std::async(std::launch::async, read_block,
+      std::cref(f), buffer[0], std::min(bs, c.size), c.offset);
+
+  for (int b = 0; pos < c.size; b ^= 1)
+  {
+    int64_t bytes = next.get();
+    if (bytes <= 0)
+    {
+      // bytes = 0 if the file has been truncated
+      c.error = (bytes < 0) ? (int) -bytes : EIO;
+      break;
+    }
+
+    pos += (uint64_t) bytes;
+    if (pos < c.size)
+      next = std::async(std::launch::async, read_block, std::cref(f),
+          buffer[b ^ 1], std::min(bs, c.size - pos), c.offset + pos);
+
+    cnt += popcnt(buffer[b], (uint64_t) bytes);
+  }
+
+  return cnt;
+}
+
+/// Count the chunk using mmap(). Each thread maps its own
+/// chunk so that MAP_POPULATE faults in the pages in parallel.
+uint64_t count_mmap(const file& f,
+                    chunk& c,
+                    const options& opts)
+{
+#if defined(POPCNT_HAVE_POSIX)
+  uint64_t page_size = (uint64_t) sysconf(_SC_PAGESIZE);
+  uint64_t start = c.offset - c.offset % page_size;
+  uint64_t len = c.offset + c.size - start;
+  int flags = MAP_SHARED;
+
+#if defined(MAP_POPULATE)
+  if (opts.populate)
+    flags |= MAP_POPULATE;
+#endif
+
+  void* ptr = mmap(NULL, (size_t) len, PROT_READ, flags, f.fd, (off_t) start);
+  if (ptr == MAP_FAILED)
+  {
+    c.error = errno;
+    return 0;
+  }
+
+  if (opts.sequential)
+    madvise(ptr, (size_t) len, MADV_SEQUENTIAL);
+
+  uint64_t cnt = popcnt((const uint8_t*) ptr + (c.offset - start), c.size);
+  munmap(ptr, (size_t) len);
+
+  return cnt;
+#else
+  (void) f;
+  (void) c;
+  (void) opts;
+  return 0;
+#endif
+}
+
+void count_chunks(const std::vector<file>& files,
+                  std::vector<chunk>& chunks,
+                  std::atomic<size_t>& next,
+                  const options& opts)
+{
+  std::vector<uint8_t> buffers;
+  if (opts.read)
+    buffers.resize(opts.buffer_size * 2);
+
+  for (size_t i = next++; i < chunks.size(); i = next++)
+  {
+    chunk& c = chunks[i];
+    const file& f = files[c.file];
+
+    if (opts.read)
+      c.count = count_read(f, c, buffers, opts);
+    else
+      c.count = count_mmap(f, c, opts);
+  }
+}
+
+/// Add the data extents of the i-th file. Holes of sparse files
+/// read as zeros, hence they are skipped using lseek(SEEK_DATA)
+/// and lseek(SEEK_HOLE) so that they are neither read nor
+/// faulted in. If the file system does not support SEEK_DATA
+/// the rest of the file is a single extent.
+void get_extents(const file& f,
+                 size_t i,
+                 const options& opts,
+                 std::vector<extent>& extents)
+{
+  uint64_t offset = 0;
+
+#if defined(POPCNT_HAVE_POSIX) && \
+    defined(SEEK_DATA) && \
+    defined(SEEK_HOLE)
+  while (opts.sparse && offset < f.size)
+  {
+    off_t data = lseek(f.fd, (off_t) offset, SEEK_DATA);
+
+    // ENXIO: there is no more data after offset
+    if (data < 0 && errno == ENXIO)
+      return;
+    if (data < 0)
+      break;
+
+    off_t hole = lseek(f.fd, data, SEEK_HOLE);
+    if (hole < 0)
+      break;
+
+    uint64_t first = std::min((uint64_t) data, f.size);
+    uint64_t last = std::min((uint64_t) hole, f.size);
+    if (first < last)
+    {
+      extent e = { i, first, last - first };
+      extents.push_back(e);
+    }
+
+    offset = std::max(last, offset + 1);
+  }
+#else
+  (void) opts;
+#endif
+
+  if (offset < f.size)
+  {
+    extent e = { i, offset, f.size - offset };
+    extents.push_back(e);
+  }
+}
+
+/// Split the data extents of the files into chunks so that all
+/// threads are busy even if there is only a single file. The
+/// chunk size is a multiple of 1 MiB, hence of the page size.
+std::vector<chunk> get_chunks(const std::vector<file>& files,
+                              const options& opts,
+                              int threads)
+{
+  std::vector<extent> extents;
+  uint64_t total = 0;
+
+  for (size_t i = 0; i < files.size(); i++)
+    if (!files[i].error)
+      get_extents(files[i], i, opts, extents);
+
+  for (const extent& e : extents)
+    total += e.size;
+
+  uint64_t mib = 1 << 20;
+  uint64_t chunk_size = total / ((uint64_t) threads * 4);
+  chunk_size = std::max(chunk_size - chunk_size % mib, mib);
+  chunk_size = std::min(chunk_size, 64 * mib);
+
+  std::vector<chunk> chunks;
+
+  for (const extent& e : extents)
+  {
+    for (uint64_t pos = 0; pos < e.size; pos += chunk_size)
+    {
+      uint64_t size = std::min(chunk_size, e.size - pos);
+      chunk c = { e.file, e.offset + pos, size, 0, 0 };
+      chunks.push_back(c);
+    }
+  }
+
+  return chunks;
+}
+
+void usage()
+{
+  std::cout << "Usage: ./popcnt [options] FILE..." << std::endl;
+  std::cout << "Count the number of 1 bits in each FILE." << std::endl;
+  std::cout << std::endl;
+  std::cout << "Options:" << std::endl;
+  std::cout << "  --threads=N        Number of threads (default all CPUs)" << std::endl;
+  std::cout << "  --mmap             Count memory mapped files (default)" << std::endl;
+  std::cout << "  --populate         mmap() using MAP_POPULATE (Linux)" << std::endl;
+  std::cout << "  --sequential       madvise(MADV_SEQUENTIAL)" << std::endl;
+  std::cout << "  --read             Read the files using pread() with double buffering" << std::endl;
+  std::cout << "  --buffer=BYTES     pread() buffer size per thread (default 4 MiB)" << std::endl;
+  std::cout << "  --no-sparse        Do not skip the holes of sparse files" << std::endl;
+  std::cout << "  --stats            Print the elapsed time and GB/s" << std::endl;
+  std::exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+  options opts;
+  std::vector<file> files;
+
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    std::string value;
+    size_t eq = arg.find('=');
+
+    if (arg.compare(0, 2, "--") != 0)
+    {
+      file f;
+      f.name = arg;
+      files.push_back(f);
+      continue;
+    }
+
+    if (eq != std::string::npos)
+      value = arg.substr(eq + 1);
+    arg = arg.substr(0, eq);
+
+    if (arg == "--threads")
+      opts.threads = std::atoi(value.c_str());
+    else if (arg == "--mmap")
+      opts.read = false;
+    else if (arg == "--populate")
+      opts.populate = true;
+    else if (arg == "--sequential")
+      opts.sequential = true;
+    else if (arg == "--read")
+      opts.read = true;
+    else if (arg == "--buffer")
+      opts.buffer_size = std::max(std::strtoull(value.c_str(), NULL, 10), 4096ull);
+    else if (arg == "--no-sparse")
+      opts.sparse = false;
+    else if (arg == "--stats")
+      opts.stats = true;
+    else
+      usage();
+  }
+
+  if (files.empty())
+    usage();
+
+#if !defined(POPCNT_HAVE_POSIX)
+  // mmap() is not supported
+  opts.read = true;
+#endif
+
+  if (opts.threads <= 0)
+    opts.threads = std::max((int) std::thread::hardware_concurrency(), 1);
+
+  double seconds = get_seconds();
+
+  for (file& f : files)
+    open_file(f);
+
+  std::vector<chunk> chunks = get_chunks(files, opts, opts.threads);
+  std::vector<std::thread> threads;
+  std::atomic<size_t> next(0);
+  int nthreads = (int) std::min((size_t) opts.threads, chunks.size());
+
+  for (int t = 1; t < nthreads; t++)
+    threads.emplace_back(count_chunks, std::cref(files), std::ref(chunks), std::ref(next), std::cref(opts));
+
+  count_chunks(files, chunks, next, opts);
+
+  for (std::thread& t : threads)
+    t.join();
+
+  seconds = get_seconds() - seconds;
+
+  std::vector<uint64_t> counts(files.size(), 0);
+  uint64_t data_bytes = 0;
+
+  for (const chunk& c : chunks)
+  {
+    counts[c.file] += c.count;
+    data_bytes += c.size;
+    if (c.error && !files[c.file].error)
+      files[c.file].error = c.error;
+  }
+
+  uint64_t total = 0;
+  uint64_t bytes = 0;
+  int status = 0;
+
+  for (size_t i = 0; i < files.size(); i++)
+  {
+    close_file(files[i]);
+
+    if (files[i].error)
+    {
+      std::cerr << "popcnt: " << files[i].name << ": " << error_message(files[i].error) << std::endl;
+      status = 1;
+      continue;
+    }
+
+    std::cout << counts[i] << " " << files[i].name << std::endl;
+    total += counts[i];
+    bytes += files[i].size;
+  }
+
+  if (files.size() > 1)
+    std::cout << total << " total" << std::endl;
+
+  if (opts.stats)
+  {
+    std::cerr << "Bytes: " << bytes << std::endl;
+    std::cerr << "Data bytes: " << data_bytes << std::endl;
+    std::cerr << "Threads: " << nthreads << std::endl;
+    std::cerr << "Seconds: " << std::fixed << std::setprecision(3) << seconds << std::endl;
+    std::cerr << "GB/s: " << std::fixed << std::setprecision(2) << data_bytes / std::max(seconds, 1e-9) / 1e9 << std::endl;
+  }
+
+  return status;
+}
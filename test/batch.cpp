@@ -0,0 +1,75 @@
+///
+/// @file  batch.cpp
+/// @brief Test popcnt_batch() which counts the 1 bits of many
+///        arrays in one call. The results are checked against
+///        popcnt64_bitwise().
+///
+/// Copyright (C) 2026 Kim Walisch, <kim.walisch@gmail.com>
+///
+/// This file is distributed under the BSD License. See the LICENSE
+/// file in the top level directory.
+///
+
+#include <libpopcnt.h>
+
+#include <iostream>
+#include <vector>
+#include <ctime>
+#include <cstdlib>
+#include <stdint.h>
+
+using namespace std;
+
+int main()
+{
+  size_t size = 1 << 20;
+  vector<uint8_t> data(size);
+
+  srand((unsigned) time(0));
+
+  // generate array with random data
+  for (size_t i = 0; i < size; i++)
+    data[i] = (uint8_t) rand();
+
+  for (size_t n = 0; n < 1000; n += 1 + n / 4)
+  {
+    vector<const void*> ptrs(n);
+    vector<uint64_t> sizes(n);
+    vector<uint64_t> out(n + 1, 123);
+
+    for (size_t i = 0; i < n; i++)
+    {
+      // mostly small arrays, some large arrays
+      sizes[i] = (rand() % 8 == 0) ? rand() % 5000 : rand() % 300;
+      ptrs[i] = &data[rand() % (size - sizes[i])];
+    }
+
+    popcnt_batch(ptrs.data(), sizes.data(), n, out.data());
+
+    for (size_t i = 0; i < n; i++)
+    {
+      const uint8_t* ptr = (const uint8_t*) ptrs[i];
+      uint64_t bits_verify = 0;
+
+      for (size_t j = 0; j < sizes[i]; j++)
+        bits_verify += popcnt64_bitwise(ptr[j]);
+
+      if (out[i] != bits_verify)
+      {
+        cerr << "libpopcnt popcnt_batch() test failed!" << endl;
+        exit(1);
+      }
+    }
+
+    // popcnt_batch() must not write beyond out[n - 1]
+    if (out[n] != 123)
+    {
+      cerr << "libpopcnt popcnt_batch() test failed!" << endl;
+      exit(1);
+    }
+  }
+
+  cout << "libpopcnt tested successfully!" << endl;
+
+  return 0;
+}
@@ -0,0 +1,136 @@
+///
+/// @file  bitset.cpp
+/// @brief Test libpopcnt::bitset against std::vector<bool>.
+///
+/// Copyright (C) 2026 Kim Walisch, <kim.walisch@gmail.com>
+///
+/// This file is distributed under the BSD License. See the LICENSE
+/// file in the top level directory.
+///
+
+#include <libpopcnt.h>
+
+#include <iostream>
+#include <vector>
+#include <ctime>
+#include <cstdlib>
+#include <stdint.h>
+
+using namespace std;
+
+void check(bool ok, const char* name)
+{
+  if (!ok)
+  {
+    cerr << endl;
+    cerr << "libpopcnt " << name << " test failed!" << endl;
+    exit(1);
+  }
+}
+
+void verify(const libpopcnt::bitset& bs, const vector<bool>& bits)
+{
+  uint64_t cnt = 0;
+  vector<uint64_t> positions;
+
+  for (size_t i = 0; i < bits.size(); i++)
+  {
+    if (i % 97 == 0)
+      check(bs.rank(i) == cnt, "bitset::rank()");
+    check(bs.test(i) == bits[i], "bitset::test()");
+    if (bits[i])
+    {
+      positions.push_back(i);
+      cnt++;
+    }
+  }
+
+  check(bs.rank(bits.size()) == cnt, "bitset::rank()");
+  check(bs.count() == cnt, "bitset::count()");
+
+  for (size_t k = 0; k < positions.size(); k += 1 + positions.size() / 50)
+    check(bs.select(k) == positions[k], "bitset::select()");
+
+  check(bs.select(cnt) == bits.size(), "bitset::select()");
+}
+
+libpopcnt::bitset random_bitset(vector<bool>& bits)
+{
+  vector<uint8_t> data((bits.size() + 7) / 8 + 1);
+
+  for (size_t i = 0; i < data.size(); i++)
+    data[i] = (uint8_t) rand();
+
+  for (size_t i = 0; i < bits.size(); i++)
+    bits[i] = (data[i / 8] >> (i % 8)) & 1;
+
+  return libpopcnt::bitset(&data[0], bits.size());
+}
+
+int main()
+{
+  srand((unsigned) time(0));
+
+  size_t sizes[] = { 0, 1, 7, 64, 100, 4095, 4096, 4097, 10000, 50000, 100003 };
+
+  for (size_t size : sizes)
+  {
+    vector<bool> bits(size);
+    libpopcnt::bitset bs = random_bitset(bits);
+    check(bs.size() == size, "bitset::size()");
+    verify(bs, bits);
+
+    if (size == 0)
+      continue;
+
+    for (int i = 0; i < 2000; i++)
+    {
+      size_t pos = rand() % size;
+
+      switch (rand() % 3)
+      {
+        case 0: bs.set(pos); bits[pos] = true; break;
+        case 1: bs.reset(pos); bits[pos] = false; break;
+        case 2: bs.flip(pos); bits[pos] = !bits[pos]; break;
+      }
+
+      if (i % 500 == 0)
+        check(bs.count() == libpopcnt::bitset(bs).count(), "bitset::count()");
+    }
+
+    verify(bs, bits);
+
+    for (int op = 0; op < 3; op++)
+    {
+      vector<bool> bits2(size);
+      libpopcnt::bitset bs2 = random_bitset(bits2);
+
+      for (size_t i = 0; i < size; i++)
+      {
+        if (op == 0) bits[i] = bits[i] & bits2[i];
+        if (op == 1) bits[i] = bits[i] | bits2[i];
+        if (op == 2) bits[i] = bits[i] ^ bits2[i];
+      }
+
+      if (op == 0) bs &= bs2;
+      if (op == 1) bs |= bs2;
+      if (op == 2) bs ^= bs2;
+
+      verify(bs, bits);
+    }
+  }
+
+  libpopcnt::bitset empty(1000);
+  check(empty.count() == 0 && empty.select(0) == 1000, "bitset::bitset()");
+
+  libpopcnt::bitset none;
+  check(none.rank(0) == 0 && none.select(0) == 0, "bitset::rank()");
+
+  vector<uint8_t> ones(4096 / 8, 0xff);
+  libpopcnt::bitset full(&ones[0], 4096);
+  check(full.rank(4096) == 4096 && full.rank(4095) == 4095, "bitset::rank()");
+
+  cout << "libpopcnt tested successfully!" << endl;
+
+  return 0;
+}
@@ -0,0 +1,131 @@
+///
+/// @file  cached.cpp
+/// @brief Test libpopcnt::cached_popcnt, after modifying random
+///        pages the cached count must match popcnt().
+///
+/// Copyright (C) 2026 Kim Walisch, <kim.walisch@gmail.com>
+///
+/// This file is distributed under the BSD License. See the LICENSE
+/// file in the top level directory.
+///
+
+#define LIBPOPCNT_CACHED_POPCNT
+#include <libpopcnt.h>
+
+#include <iostream>
+#include <vector>
+#include <ctime>
+#include <cstdlib>
+#include <stdint.h>
+
+using namespace std;
+
+void check(bool ok, const char* name)
+{
+  if (!ok)
+  {
+    cerr << endl;
+    cerr << "libpopcnt " << name << " test failed!" << endl;
+    exit(1);
+  }
+}
+
+int main()
+{
+  srand((unsigned) time(0));
+
+  size_t sizes[] = { 0, 1, 100, 4096, 4097, 100000, 1 << 20 };
+  size_t page_sizes[] = { 64, 4096, 10000 };
+
+  for (size_t size : sizes)
+  {
+    for (size_t page_size : page_sizes)
+    {
+      vector<uint8_t> data(size);
+      for (size_t i = 0; i < size; i++)
+        data[i] = (uint8_t) rand();
+
+      libpopcnt::cached_popcnt cache(data.data(), size, page_size);
+      check(cache.count() == popcnt(data.data(), size), "cached_popcnt::count()");
+      check(cache.dirty_pages() == 0, "cached_popcnt::dirty_pages()");
+
+      if (size == 0)
+        continue;
+
+      for (int i = 0; i < 10; i++)
+      {
+        for (int j = 0; j < 20; j++)
+        {
+          size_t offset = rand() % size;
+          size_t len = 1 + rand() % 100;
+          if (offset + len > size)
+            len = size - offset;
+          for (size_t k = offset; k < offset + len; k++)
+            data[k] = (uint8_t) rand();
+          cache.mark_dirty(offset, len);
+        }
+
+        check(cache.count() == popcnt(data.data(), size), "cached_popcnt::mark_dirty()");
+      }
+
+      data[size - 1] ^= 1;
+      cache.mark_all_dirty();
+      check(cache.count() == popcnt(data.data(), size), "cached_popcnt::mark_all_dirty()");
+    }
+  }
+
+#if defined(LIBPOPCNT_HAVE_SOFT_DIRTY)
+  // Soft-dirty bits are not supported by all kernels
+  vector<uint8_t> data(1 << 22, 0);
+  libpopcnt::cached_popcnt cache(data.data(), data.size());
+
+  if (cache.track_soft_dirty())
+  {
+    for (int i = 0; i < 10; i++)
+    {
+      for (int j = 0; j < 50; j++)
+        data[rand() % data.size()] = (uint8_t) rand();
+
+      check(cache.count() == popcnt(data.data(), data.size()), "cached_popcnt::track_soft_dirty()");
+    }
+
+    // All tracking objects share the process-wide soft-dirty bits,
+    // counting one object must not lose the writes of the others,
+    // including writes right before the bits are cleared.
+    vector<uint8_t> data2(1 << 20, 0);
+    libpopcnt::cached_popcnt cache2(data2.data(), data2.size());
+    check(cache2.track_soft_dirty(), "cached_popcnt::track_soft_dirty()");
+
+    for (int i = 0; i < 10; i++)
+    {
+      data[rand() % data.size()] = (uint8_t) rand();
+      data2[rand() % data2.size()] = (uint8_t) rand();
+
+      {
+        vector<uint8_t> data3(1 << 16, 1);
+        libpopcnt::cached_popcnt cache3(data3.data(), data3.size());
+        cache3.track_soft_dirty();
+        data3[rand() % data3.size()] = 3;
+        check(cache3.count() == popcnt(data3.data(), data3.size()), "cached_popcnt::track_soft_dirty()");
+      }
+
+      if (i % 2)
+      {
+        check(cache.count() == popcnt(data.data(), data.size()), "cached_popcnt::track_soft_dirty()");
+        check(cache2.count() == popcnt(data2.data(), data2.size()), "cached_popcnt::track_soft_dirty()");
+      }
+      else
+      {
+        check(cache2.count() == popcnt(data2.data(), data2.size()), "cached_popcnt::track_soft_dirty()");
+        check(cache.count() == popcnt(data.data(), data.size()), "cached_popcnt::track_soft_dirty()");
+      }
+    }
+  }
+  else
+    cout << "Soft-dirty bits not supported" << endl;
+#endif
+
+  cout << "libpopcnt tested successfully!" << endl;
+
+  return 0;
+}
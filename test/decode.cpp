@@ -0,0 +1,72 @@
+///
+/// @file  decode.cpp
+/// @brief Test bitmap_decode() against a simple bit by bit
+///        implementation. The out array is sized using
+///        popcnt(), hence writes past its end are detected
+///        by e.g. -fsanitize=address.
+///
+/// Copyright (C) 2026 Kim Walisch, <kim.walisch@gmail.com>
+///
+/// This file is distributed under the BSD License. See the LICENSE
+/// file in the top level directory.
+///
+
+#include <libpopcnt.h>
+
+#include <iostream>
+#include <vector>
+#include <ctime>
+#include <cstdlib>
+#include <stdint.h>
+
+using namespace std;
+
+void check(bool ok, const char* name)
+{
+  if (!ok)
+  {
+    cerr << endl;
+    cerr << "libpopcnt " << name << " test failed!" << endl;
+    exit(1);
+  }
+}
+
+int main()
+{
+  srand((unsigned) time(0));
+
+  vector<uint8_t> data(20000 + 1);
+
+  for (size_t size = 0; size < data.size(); size += (size < 300) ? 1 : 1 + rand() % 1000)
+  {
+    // Sparse, dense and random bitmaps
+    int density = rand() % 3;
+
+    for (size_t i = 0; i < data.size(); i++)
+      data[i] = (uint8_t) ((density == 0) ? (rand() % 16 == 0) << (rand() % 8) : (density == 1) ? rand() | rand() : rand());
+
+    const uint8_t* ptr = &data[size % 2];
+    vector<uint32_t> expected;
+
+    for (size_t x = 0; x < size * 8; x++)
+      if ((ptr[x / 8] >> (x % 8)) & 1)
+        expected.push_back((uint32_t) x);
+
+    uint64_t cnt = popcnt(ptr, size);
+    check(cnt == expected.size(), "popcnt()");
+
+    uint32_t* out = new uint32_t[cnt + 1];
+    out[cnt] = 0xdeadbeef;
+    check(bitmap_decode(ptr, size, out) == cnt, "bitmap_decode()");
+    check(out[cnt] == 0xdeadbeef, "bitmap_decode()");
+
+    for (size_t i = 0; i < cnt; i++)
+      check(out[i] == expected[i], "bitmap_decode()");
+
+    delete[] out;
+  }
+
+  cout << "libpopcnt tested successfully!" << endl;
+
+  return 0;
+}
@@ -0,0 +1,82 @@
+///
+/// @file  expr.cpp
+/// @brief Test popcnt_expr() boolean expressions of bitmaps
+///        against a simple byte by byte implementation
+///        using popcnt64_bitwise().
+///
+/// Copyright (C) 2026 Kim Walisch, <kim.walisch@gmail.com>
+///
+/// This file is distributed under the BSD License. See the LICENSE
+/// file in the top level directory.
+///
+
+#include <libpopcnt.h>
+
+#include <iostream>
+#include <vector>
+#include <ctime>
+#include <cstdlib>
+#include <stdint.h>
+
+using namespace std;
+using libpopcnt::bits;
+
+void check(bool ok, const char* name)
+{
+  if (!ok)
+  {
+    cerr << endl;
+    cerr << "libpopcnt " << name << " test failed!" << endl;
+    exit(1);
+  }
+}
+
+int main()
+{
+  srand((unsigned) time(0));
+
+  size_t sizes[] = { 0, 1, 7, 8, 31, 32, 40, 63, 64, 100, 127, 128, 511, 512, 1000, 4096, 10007 };
+
+  for (size_t size : sizes)
+  {
+    vector<vector<uint8_t>> data(5, vector<uint8_t>(size + 1));
+
+    for (auto& v : data)
+      for (auto& byte : v)
+        byte = (uint8_t) rand();
+
+    // Unaligned bitmaps
+    const uint8_t* a = &data[0][0];
+    const uint8_t* b = &data[1][1];
+    const uint8_t* c = &data[2][0];
+    const uint8_t* d = &data[3][1];
+    const uint8_t* e = &data[4][0];
+
+    uint64_t cnt[8] = { 0 };
+
+    for (size_t i = 0; i < size; i++)
+    {
+      cnt[0] += popcnt64_bitwise((uint8_t) ~a[i]);
+      cnt[1] += popcnt64_bitwise(a[i] & b[i]);
+      cnt[2] += popcnt64_bitwise((uint8_t) (a[i] & ~b[i]));
+      cnt[3] += popcnt64_bitwise((a[i] & b[i]) | c[i]);
+      cnt[4] += popcnt64_bitwise((a[i] & b[i]) | (c[i] & ~d[i]));
+      cnt[5] += popcnt64_bitwise((uint8_t) ~((a[i] ^ b[i]) | (c[i] & d[i])));
+      cnt[6] += popcnt64_bitwise(((a[i] | b[i]) & (c[i] | d[i])) ^ e[i]);
+      cnt[7] += popcnt64_bitwise((uint8_t) (~a[i] & ~b[i] & ~c[i] & ~d[i] & ~e[i]));
+    }
+
+    check(libpopcnt::popcnt_expr(~bits(a), size) == cnt[0], "popcnt_expr()");
+    check(libpopcnt::popcnt_expr(bits(a) & bits(b), size) == cnt[1], "popcnt_expr()");
+    check(libpopcnt::popcnt_expr(bits(a) & ~bits(b), size) == cnt[2], "popcnt_expr()");
+    check(libpopcnt::popcnt_expr((bits(a) & bits(b)) | bits(c), size) == cnt[3], "popcnt_expr()");
+    check(libpopcnt::popcnt_expr((bits(a) & bits(b)) | (bits(c) & ~bits(d)), size) == cnt[4], "popcnt_expr()");
+    check(libpopcnt::popcnt_expr(~((bits(a) ^ bits(b)) | (bits(c) & bits(d))), size) == cnt[5], "popcnt_expr()");
+    check(libpopcnt::popcnt_expr(((bits(a) | bits(b)) & (bits(c) | bits(d))) ^ bits(e), size) == cnt[6], "popcnt_expr()");
+    check(libpopcnt::popcnt_expr(~bits(a) & ~bits(b) & ~bits(c) & ~bits(d) & ~bits(e), size) == cnt[7], "popcnt_expr()");
+  }
+
+  cout << "libpopcnt tested successfully!" << endl;
+
+  return 0;
+}
@@ -0,0 +1,120 @@
+///
+/// @file  hamming.cpp
+/// @brief Test popcnt_xor(), popcnt_xor_bounded(),
+///        popcnt_hamming_topk() and popcnt_hamming_radius()
+///        against a simple brute force search using
+///        popcnt64_bitwise().
+///
+/// Copyright (C) 2026 Kim Walisch, <kim.walisch@gmail.com>
+///
+/// This file is distributed under the BSD License. See the LICENSE
+/// file in the top level directory.
+///
+
+#include <libpopcnt.h>
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+#include <vector>
+#include <ctime>
+#include <cstdlib>
+#include <stdint.h>
+
+using namespace std;
+
+void check(bool ok, const char* name)
+{
+  if (!ok)
+  {
+    cerr << endl;
+    cerr << "libpopcnt " << name << " test failed!" << endl;
+    exit(1);
+  }
+}
+
+uint64_t hamming(const uint8_t* a, const uint8_t* b, size_t size)
+{
+  uint64_t dist = 0;
+  for (size_t i = 0; i < size; i++)
+    dist += popcnt64_bitwise(a[i] ^ b[i]);
+  return dist;
+}
+
+int main()
+{
+  srand((unsigned) time(0));
+
+  size_t sizes[] = { 1, 7, 8, 20, 32, 40, 64, 100, 128, 256, 300, 512, 1000, 2048, 10000 };
+
+  for (size_t size : sizes)
+  {
+    size_t n = 2000 + rand() % 100;
+    vector<uint8_t> query(size);
+    vector<uint8_t> db(size * n);
+
+    for (size_t i = 0; i < size; i++)
+      query[i] = (uint8_t) rand();
+
+    // Fingerprints similar to the query, many ties
+    for (size_t i = 0; i < db.size(); i++)
+      db[i] = query[i % size] ^ (uint8_t) ((rand() % 4 == 0) ? rand() : 0);
+
+    vector<pair<uint64_t, uint64_t>> expected(n);
+
+    for (size_t i = 0; i < n; i++)
+    {
+      uint64_t dist = hamming(&query[0], &db[i * size], size);
+      check(popcnt_xor(&query[0], &db[i * size], size) == dist, "popcnt_xor()");
+      check(popcnt_xor_bounded(&query[0], &db[i * size], size, dist) == dist, "popcnt_xor_bounded()");
+      check(popcnt_xor_bounded(&query[0], &db[i * size], size, dist + 1) == dist, "popcnt_xor_bounded()");
+      if (dist > 0)
+      {
+        check(popcnt_xor_bounded(&query[0], &db[i * size], size, dist - 1) > dist - 1, "popcnt_xor_bounded()");
+        check(popcnt_xor_bounded(&query[0], &db[i * size], size, 0) > 0, "popcnt_xor_bounded()");
+      }
+      expected[i] = make_pair(dist, i);
+    }
+
+    sort(expected.begin(), expected.end());
+
+    size_t ks[] = { 0, 1, 5, 64, n, n + 10 };
+
+    for (size_t k : ks)
+    {
+      vector<uint64_t> indexes(k);
+      vector<uint64_t> distances(k);
+      uint64_t count = popcnt_hamming_topk(&query[0], &db[0], size, n, k, indexes.data(), distances.data());
+
+      check(count == min(k, n), "popcnt_hamming_topk()");
+      for (size_t i = 0; i < count; i++)
+        check(distances[i] == expected[i].first &&
+              indexes[i] == expected[i].second, "popcnt_hamming_topk()");
+    }
+
+    uint64_t radius = expected[n / 3].first;
+    size_t max_results = n / 2;
+    vector<uint64_t> indexes(max_results);
+    vector<uint64_t> distances(max_results);
+    uint64_t count = popcnt_hamming_radius(&query[0], &db[0], size, n, radius, max_results, indexes.data(), distances.data());
+    uint64_t count_verify = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+      uint64_t dist = hamming(&query[0], &db[i * size], size);
+      if (dist <= radius)
+      {
+        if (count_verify < max_results)
+          check(indexes[count_verify] == i &&
+                distances[count_verify] == dist, "popcnt_hamming_radius()");
+        count_verify++;
+      }
+    }
+
+    check(count == count_verify, "popcnt_hamming_radius()");
+  }
+
+  cout << "libpopcnt tested successfully!" << endl;
+
+  return 0;
+}
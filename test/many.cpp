@@ -0,0 +1,87 @@
+///
+/// @file  many.cpp
+/// @brief Test popcnt_and_many(), popcnt_or_many() and
+///        popcnt_xor_many() against a simple byte by byte
+///        implementation using popcnt64_bitwise().
+///
+/// Copyright (C) 2026 Kim Walisch, <kim.walisch@gmail.com>
+///
+/// This file is distributed under the BSD License. See the LICENSE
+/// file in the top level directory.
+///
+
+#include <libpopcnt.h>
+
+#include <iostream>
+#include <vector>
+#include <ctime>
+#include <cstdlib>
+#include <stdint.h>
+
+using namespace std;
+
+void check(bool ok, const char* name)
+{
+  if (!ok)
+  {
+    cerr << endl;
+    cerr << "libpopcnt " << name << " test failed!" << endl;
+    exit(1);
+  }
+}
+
+int main()
+{
+  srand((unsigned) time(0));
+
+  size_t sizes[] = { 0, 1, 7, 8, 31, 32, 40, 63, 64, 100, 127, 128, 511, 512, 1000, 4096, 10007 };
+
+  for (size_t size : sizes)
+  {
+    for (int k = 0; k <= 16; k++)
+    {
+      vector<vector<uint8_t>> data(k);
+      vector<const void*> bitmaps(k);
+
+      for (int j = 0; j < k; j++)
+      {
+        // The last array has an odd offset
+        data[j].resize(size + 1);
+        for (size_t i = 0; i < data[j].size(); i++)
+          data[j][i] = (uint8_t) (rand() | rand());
+        bitmaps[j] = &data[j][j == k - 1];
+      }
+
+      uint64_t cnt_and = 0;
+      uint64_t cnt_or = 0;
+      uint64_t cnt_xor = 0;
+
+      for (size_t i = 0; k > 0 && i < size; i++)
+      {
+        uint8_t a = ((const uint8_t*) bitmaps[0])[i];
+        uint8_t o = a;
+        uint8_t x = a;
+
+        for (int j = 1; j < k; j++)
+        {
+          uint8_t b = ((const uint8_t*) bitmaps[j])[i];
+          a &= b;
+          o |= b;
+          x ^= b;
+        }
+
+        cnt_and += popcnt64_bitwise(a);
+        cnt_or += popcnt64_bitwise(o);
+        cnt_xor += popcnt64_bitwise(x);
+      }
+
+      check(popcnt_and_many(bitmaps.data(), k, size) == cnt_and, "popcnt_and_many()");
+      check(popcnt_or_many(bitmaps.data(), k, size) == cnt_or, "popcnt_or_many()");
+      check(popcnt_xor_many(bitmaps.data(), k, size) == cnt_xor, "popcnt_xor_many()");
+    }
+  }
+
+  cout << "libpopcnt tested successfully!" << endl;
+
+  return 0;
+}
@@ -0,0 +1,78 @@
+///
+/// @file  masked.cpp
+/// @brief Test popcnt_masked() and popcnt_and() against
+///        a simple byte by byte implementation using
+///        popcnt64_bitwise().
+///
+/// Copyright (C) 2026 Kim Walisch, <kim.walisch@gmail.com>
+///
+/// This file is distributed under the BSD License. See the LICENSE
+/// file in the top level directory.
+///
+
+#include <libpopcnt.h>
+
+#include <iostream>
+#include <vector>
+#include <ctime>
+#include <cstdlib>
+#include <stdint.h>
+
+using namespace std;
+
+void check(bool ok, const char* name)
+{
+  if (!ok)
+  {
+    cerr << endl;
+    cerr << "libpopcnt " << name << " test failed!" << endl;
+    exit(1);
+  }
+}
+
+int main()
+{
+  srand((unsigned) time(0));
+
+  size_t sizes[] = { 0, 1, 7, 8, 31, 32, 63, 64, 100, 1000, 16384, 16385, 40000 };
+  int ns[] = { 0, 1, 2, 3, 4, 5, 8, 9, 13 };
+
+  for (size_t size : sizes)
+  {
+    vector<uint8_t> mask(size + 1);
+
+    for (size_t i = 0; i < mask.size(); i++)
+      mask[i] = (uint8_t) rand();
+
+    for (int n : ns)
+    {
+      vector<vector<uint8_t>> data(n, vector<uint8_t>(size + 1));
+      vector<const void*> columns(n);
+      vector<uint64_t> out(n + 1, 12345);
+
+      for (int j = 0; j < n; j++)
+      {
+        for (size_t i = 0; i < data[j].size(); i++)
+          data[j][i] = (uint8_t) rand();
+        columns[j] = &data[j][j % 2];
+      }
+
+      popcnt_masked(&mask[1], columns.data(), n, size, out.data());
+      check(out[n] == 12345, "popcnt_masked()");
+
+      for (int j = 0; j < n; j++)
+      {
+        uint64_t cnt = 0;
+        for (size_t i = 0; i < size; i++)
+          cnt += popcnt64_bitwise(mask[1 + i] & ((const uint8_t*) columns[j])[i]);
+
+        check(out[j] == cnt, "popcnt_masked()");
+        check(popcnt_and(columns[j], &mask[1], size) == cnt, "popcnt_and()");
+      }
+    }
+  }
+
+  cout << "libpopcnt tested successfully!" << endl;
+
+  return 0;
+}
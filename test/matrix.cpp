@@ -0,0 +1,82 @@
+///
+/// @file  matrix.cpp
+/// @brief Test popcnt_hamming_matrix() and popcnt_tanimoto_matrix()
+///        against a simple loop over all pairs of fingerprints.
+///
+/// Copyright (C) 2026 Kim Walisch, <kim.walisch@gmail.com>
+///
+/// This file is distributed under the BSD License. See the LICENSE
+/// file in the top level directory.
+///
+
+#include <libpopcnt.h>
+
+#include <iostream>
+#include <vector>
+#include <ctime>
+#include <cstdlib>
+#include <stdint.h>
+
+using namespace std;
+
+void check(bool ok, const char* name)
+{
+  if (!ok)
+  {
+    cerr << endl;
+    cerr << "libpopcnt " << name << " test failed!" << endl;
+    exit(1);
+  }
+}
+
+int main()
+{
+  srand((unsigned) time(0));
+
+  size_t sizes[] = { 0, 1, 8, 13, 32, 64, 100, 128, 256, 512, 1024, 5000 };
+
+  for (size_t size : sizes)
+  {
+    size_t n = 1 + rand() % 70;
+    size_t m = 1 + rand() % 1500;
+    vector<uint8_t> a(size * n + 1);
+    vector<uint8_t> b(size * m + 1);
+
+    for (size_t i = 0; i < a.size(); i++)
+      a[i] = (uint8_t) (rand() % 3 ? rand() : 0);
+    for (size_t i = 0; i < b.size(); i++)
+      b[i] = (uint8_t) (rand() % 3 ? rand() : 0);
+
+    vector<uint64_t> hamming(n * m);
+    vector<double> tanimoto(n * m);
+    popcnt_hamming_matrix(&a[0], n, &b[0], m, size, &hamming[0]);
+    popcnt_tanimoto_matrix(&a[0], n, &b[0], m, size, &tanimoto[0]);
+
+    for (size_t i = 0; i < n; i++)
+    {
+      for (size_t j = 0; j < m; j++)
+      {
+        uint64_t xor_cnt = 0;
+        uint64_t and_cnt = 0;
+        uint64_t or_cnt = 0;
+
+        for (size_t k = 0; k < size; k++)
+        {
+          uint8_t x = a[i * size + k];
+          uint8_t y = b[j * size + k];
+          xor_cnt += popcnt64_bitwise(x ^ y);
+          and_cnt += popcnt64_bitwise(x & y);
+          or_cnt += popcnt64_bitwise(x | y);
+        }
+
+        double sim = or_cnt ? (double) and_cnt / (double) or_cnt : 1.0;
+        check(hamming[i * m + j] == xor_cnt, "popcnt_hamming_matrix()");
+        check(tanimoto[i * m + j] == sim, "popcnt_tanimoto_matrix()");
+      }
+    }
+  }
+
+  cout << "libpopcnt tested successfully!" << endl;
+
+  return 0;
+}
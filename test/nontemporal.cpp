@@ -0,0 +1,88 @@
+///
+/// @file  nontemporal.cpp
+/// @brief Test popcnt() with LIBPOPCNT_NONTEMPORAL defined, arrays
+///        larger than the CPU's last level cache are counted
+///        using the streaming algorithms.
+///
+/// Copyright (C) 2026 Kim Walisch, <kim.walisch@gmail.com>
+///
+/// This file is distributed under the BSD License. See the LICENSE
+/// file in the top level directory.
+///
+
+#define LIBPOPCNT_NONTEMPORAL
+#include <libpopcnt.h>
+
+#include <iostream>
+#include <vector>
+#include <ctime>
+#include <cstdlib>
+#include <stdint.h>
+
+using namespace std;
+
+void check(uint64_t bits, uint64_t bits_verify, uint64_t size)
+{
+  if (bits != bits_verify)
+  {
+    cerr << endl;
+    cerr << "libpopcnt nontemporal test failed for size " << size << "!" << endl;
+    exit(1);
+  }
+}
+
+/// Count using chunks < 1 MiB which are
+/// never counted using the streaming algorithms.
+uint64_t popcnt_chunks(const uint8_t* data, uint64_t size)
+{
+  uint64_t cnt = 0;
+  uint64_t chunk = (1 << 20) - 1;
+
+  for (uint64_t i = 0; i < size; i += chunk)
+    cnt += popcnt(&data[i], min(chunk, size - i));
+
+  return cnt;
+}
+
+int main()
+{
+#if defined(LIBPOPCNT_HAVE_RUN_CPUID) && \
+   (defined(LIBPOPCNT_HAVE_AVX2) || \
+    defined(LIBPOPCNT_HAVE_AVX512))
+  uint64_t threshold = get_stream_threshold();
+#else
+  uint64_t threshold = 32ull << 20;
+#endif
+
+  // popcnt() only streams arrays >= 1 MiB
+  threshold = max(threshold, (uint64_t) 1 << 20);
+  cout << "Stream threshold: " << threshold << " bytes" << endl;
+
+  size_t size = (size_t) threshold + 4096;
+  vector<uint8_t> data(size);
+
+  srand((unsigned) time(0));
+
+  for (size_t i = 0; i < size; i++)
+    data[i] = (uint8_t) rand();
+
+  // Below, at and above the threshold, with unaligned
+  // start addresses and sizes that are not a multiple
+  // of the vector size.
+  uint64_t sizes[] = { threshold - 1, threshold, threshold + 1, threshold + 100, threshold + 4000 };
+
+  for (uint64_t n : sizes)
+  {
+    for (size_t offset = 0; offset < 64; offset += 13)
+    {
+      if (offset + n > size)
+        continue;
+
+      check(popcnt(&data[offset], n), popcnt_chunks(&data[offset], n), n);
+    }
+  }
+
+  cout << "libpopcnt tested successfully!" << endl;
+
+  return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * Test popcnt_records() which counts the 1 bits of each
+ * record in an array of fixed size records. The results
+ * are checked against popcnt64_bitwise().
+ *
+ * Usage: ./records
+ *
+ * Copyright (C) 2026 Kim Walisch, <kim.walisch@gmail.com>
+ *
+ * This file is distributed under the BSD License. See the LICENSE
+ * file in the top level directory.
+ */
+
+#include <libpopcnt.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <stdint.h>
+
+int main(void)
+{
+  size_t i, j, k, r;
+  size_t size = 100000;
+  size_t record_sizes[] = { 1, 8, 31, 32, 33, 64, 100, 128, 256, 512, 1000 };
+  size_t num_sizes = sizeof(record_sizes) / sizeof(record_sizes[0]);
+
+  uint8_t* data = (uint8_t*) malloc(size);
+  uint64_t* out = (uint64_t*) malloc((size + 1) * sizeof(uint64_t));
+
+  if (!data || !out)
+  {
+    printf("Failed to allocate memory!\n");
+    exit(1);
+  }
+
+  srand((unsigned) time(0));
+
+  /* generate array with random data */
+  for (i = 0; i < size; i++)
+    data[i] = (uint8_t) rand();
+
+  for (k = 0; k < num_sizes; k++)
+  {
+    size_t record_size = record_sizes[k];
+
+    /* Test unaligned records and all remainders n % 8 */
+    for (r = 0; r < 10; r++)
+    {
+      uint8_t* base = &data[r];
+      size_t n = (size - r) / record_size - r;
+
+      out[n] = 123;
+      popcnt_records(base, record_size, n, out);
+
+      for (i = 0; i < n; i++)
+      {
+        uint64_t bits_verify = 0;
+
+        for (j = 0; j < record_size; j++)
+          bits_verify += popcnt64_bitwise(base[i * record_size + j]);
+
+        if (out[i] != bits_verify)
+        {
+          printf("\nlibpopcnt popcnt_records() test failed!\n");
+          exit(1);
+        }
+      }
+
+      if (out[n] != 123)
+      {
+        printf("\nlibpopcnt popcnt_records() wrote beyond out[n - 1]!\n");
+        exit(1);
+      }
+    }
+  }
+
+  free(data);
+  free(out);
+
+  printf("libpopcnt tested successfully!\n");
+
+  return 0;
+}
@@ -0,0 +1,66 @@
+///
+/// @file  select.cpp
+/// @brief Test popcnt_select() against a simple bit by bit
+///        implementation.
+///
+/// Copyright (C) 2026 Kim Walisch, <kim.walisch@gmail.com>
+///
+/// This file is distributed under the BSD License. See the LICENSE
+/// file in the top level directory.
+///
+
+#include <libpopcnt.h>
+
+#include <iostream>
+#include <vector>
+#include <ctime>
+#include <cstdlib>
+#include <stdint.h>
+
+using namespace std;
+
+void check(bool ok, const char* name)
+{
+  if (!ok)
+  {
+    cerr << endl;
+    cerr << "libpopcnt " << name << " test failed!" << endl;
+    exit(1);
+  }
+}
+
+int main()
+{
+  srand((unsigned) time(0));
+
+  vector<uint8_t> data(20000 + 1);
+
+  for (size_t size = 0; size < data.size(); size += (size < 300) ? 1 : 1 + rand() % 1000)
+  {
+    // Sparse, dense and random bitmaps
+    int density = rand() % 3;
+
+    for (size_t i = 0; i < data.size(); i++)
+      data[i] = (uint8_t) ((density == 0) ? (rand() % 16 == 0) << (rand() % 8) : (density == 1) ? rand() | rand() : rand());
+
+    const uint8_t* ptr = &data[size % 2];
+    vector<uint64_t> positions;
+
+    for (size_t x = 0; x < size * 8; x++)
+      if ((ptr[x / 8] >> (x % 8)) & 1)
+        positions.push_back(x);
+
+    for (size_t k = 0; k < positions.size(); k += 1 + rand() % 7)
+      check(popcnt_select(ptr, size, k) == positions[k], "popcnt_select()");
+
+    if (!positions.empty())
+      check(popcnt_select(ptr, size, positions.size() - 1) == positions.back(), "popcnt_select()");
+
+    check(popcnt_select(ptr, size, positions.size()) == size * 8, "popcnt_select()");
+    check(popcnt_select(ptr, size, positions.size() + 100) == size * 8, "popcnt_select()");
+  }
+
+  cout << "libpopcnt tested successfully!" << endl;
+
+  return 0;
+}
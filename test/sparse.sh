@@ -0,0 +1,38 @@
+#!/bin/sh
+#
+# Test the popcnt tool with sparse files: the counts with holes
+# skipped (default) must match the counts with --no-sparse and
+# --read. Usage: sparse.sh /path/to/popcnt /path/to/tmpdir
+
+popcnt="$1"
+dir="$2"
+mkdir -p "$dir" || exit 1
+cd "$dir" || exit 1
+rm -f sparse1.bin sparse2.bin
+
+# 36 bits at an unaligned offset inside the first
+# extent, 4 bits in the last byte (data at EOF)
+printf 'libpopcnt' | dd of=sparse1.bin bs=1 seek=1000003 conv=notrunc 2> /dev/null
+printf 'x' | dd of=sparse1.bin bs=1 seek=9437183 conv=notrunc 2> /dev/null
+
+# data at offset 0 followed by a hole at EOF
+printf 'libpopcnt' > sparse2.bin
+dd if=/dev/null of=sparse2.bin bs=1 seek=5000001 2> /dev/null
+
+expected="40 sparse1.bin
+36 sparse2.bin
+76 total"
+
+for args in "" "--no-sparse" "--read" "--read --buffer=4096" "--threads=3"
+do
+  result=$("$popcnt" $args sparse1.bin sparse2.bin)
+
+  if [ "$result" != "$expected" ]
+  then
+    echo "popcnt $args: unexpected result:"
+    echo "$result"
+    exit 1
+  fi
+done
+
+echo "popcnt sparse files tested successfully!"
@@ -0,0 +1,105 @@
+///
+/// @file  stats.cpp
+/// @brief Test the LIBPOPCNT_STATS counters of popcnt() using
+///        multiple threads.
+///
+/// Copyright (C) 2026 Kim Walisch, <kim.walisch@gmail.com>
+///
+/// This file is distributed under the BSD License. See the LICENSE
+/// file in the top level directory.
+///
+
+#define LIBPOPCNT_STATS
+#include <libpopcnt.h>
+
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <stdint.h>
+
+using namespace std;
+
+void check(bool ok, const char* name)
+{
+  if (!ok)
+  {
+    cerr << endl;
+    cerr << "libpopcnt " << name << " test failed!" << endl;
+    exit(1);
+  }
+}
+
+void sum(const libpopcnt_stats& stats, uint64_t& calls, uint64_t& bytes)
+{
+  calls = 0;
+  bytes = 0;
+
+  for (int k = 0; k < LIBPOPCNT_KERNELS; k++)
+  {
+    uint64_t histogram = 0;
+    for (int i = 0; i < 65; i++)
+      histogram += stats.histogram[k][i];
+
+    check(histogram == stats.calls[k], "popcnt_stats_snapshot()");
+    calls += stats.calls[k];
+    bytes += stats.bytes[k];
+  }
+}
+
+int main()
+{
+  libpopcnt_stats stats;
+  uint64_t calls, bytes;
+  vector<uint8_t> data(1 << 16, 0xff);
+
+  popcnt_stats_snapshot(&stats);
+  sum(stats, calls, bytes);
+  check(calls == 0 && bytes == 0, "popcnt_stats_snapshot()");
+
+  // Sizes 0, 1, 2, 4, ..., 2^16
+  check(popcnt(&data[0], 0) == 0, "popcnt()");
+  for (size_t size = 1; size <= data.size(); size *= 2)
+    check(popcnt(&data[0], size) == size * 8, "popcnt()");
+
+  popcnt_stats_snapshot(&stats);
+  sum(stats, calls, bytes);
+  check(calls == 18 && bytes == (1 << 17) - 1, "popcnt_stats_snapshot()");
+
+  for (int b = 0; b <= 17; b++)
+  {
+    uint64_t cnt = 0;
+    for (int k = 0; k < LIBPOPCNT_KERNELS; k++)
+      cnt += stats.histogram[k][b];
+    check(cnt == 1, "histogram");
+  }
+
+  popcnt_stats_reset();
+  popcnt_stats_snapshot(&stats);
+  sum(stats, calls, bytes);
+  check(calls == 0 && bytes == 0, "popcnt_stats_reset()");
+
+  // Counters of exited threads are kept
+  vector<thread> threads;
+  for (int t = 0; t < 4; t++)
+    threads.push_back(thread([&]() {
+      for (int i = 0; i < 1000; i++)
+        popcnt(&data[0], 100 + i);
+    }));
+
+  for (thread& t : threads)
+    t.join();
+
+  popcnt_stats_snapshot(&stats);
+  sum(stats, calls, bytes);
+  check(calls == 4000 && bytes == 4 * (100 * 1000 + 999 * 1000 / 2), "threads");
+  check(popcnt_stats_kernel_name(LIBPOPCNT_KERNEL_AVX2) == string("AVX2"), "popcnt_stats_kernel_name()");
+
+  for (int k = 0; k < LIBPOPCNT_KERNELS; k++)
+    if (stats.calls[k])
+      cout << popcnt_stats_kernel_name(k) << ": " << stats.calls[k] << " calls, " << stats.bytes[k] << " bytes" << endl;
+
+  cout << "libpopcnt tested successfully!" << endl;
+
+  return 0;
+}
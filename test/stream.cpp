@@ -0,0 +1,88 @@
+///
+/// @file  stream.cpp
+/// @brief Test the streaming popcount algorithms which are used
+///        for arrays that do not fit into the CPU's cache.
+///
+/// Copyright (C) 2026 Kim Walisch, <kim.walisch@gmail.com>
+///
+/// This file is distributed under the BSD License. See the LICENSE
+/// file in the top level directory.
+///
+
+#include <libpopcnt.h>
+
+#include <iostream>
+#include <vector>
+#include <ctime>
+#include <cstdlib>
+#include <stdint.h>
+
+using namespace std;
+
+void check(uint64_t bits, uint64_t bits_verify, const char* algo)
+{
+  if (bits != bits_verify)
+  {
+    cerr << endl;
+    cerr << "libpopcnt " << algo << " test failed!" << endl;
+    exit(1);
+  }
+}
+
+int main()
+{
+  size_t size = (1 << 20) * 3 + 123;
+  vector<uint8_t> data(size);
+
+  srand((unsigned) time(0));
+
+  // generate array with random data
+  for (size_t i = 0; i < size; i++)
+    data[i] = (uint8_t) rand();
+
+#if defined(LIBPOPCNT_HAVE_CPUID) && \
+   (defined(LIBPOPCNT_HAVE_AVX2) || \
+    defined(LIBPOPCNT_HAVE_AVX512))
+  int cpuid = get_cpuid();
+#endif
+
+  for (size_t i = 0; i < 100; i += 7)
+  {
+    uint64_t bits_verify = 0;
+    for (size_t j = i; j < size; j++)
+      bits_verify += popcnt64_bitwise(data[j]);
+
+    check(popcnt(&data[i], size - i), bits_verify, "popcnt");
+
+#if defined(LIBPOPCNT_HAVE_AVX512)
+  #if defined(LIBPOPCNT_HAVE_CPUID)
+    if (cpuid & LIBPOPCNT_BIT_AVX512_VPOPCNTDQ)
+  #elif !(defined(__AVX512__) || \
+         (defined(__AVX512F__) && \
+          defined(__AVX512BW__) && \
+          defined(__AVX512VPOPCNTDQ__)))
+    if (false)
+  #endif
+      check(popcnt_avx512_stream(&data[i], size - i), bits_verify, "AVX512 stream");
+#endif
+
+#if defined(LIBPOPCNT_HAVE_AVX2)
+  #if defined(LIBPOPCNT_HAVE_CPUID)
+    if (cpuid & LIBPOPCNT_BIT_AVX2)
+  #elif !defined(__AVX2__)
+    if (false)
+  #endif
+    {
+      const __m256i* ptr256 = (const __m256i*) &data[i];
+      uint64_t bits = popcnt_avx2_stream(ptr256, (size - i) / 32);
+      for (size_t j = size - (size - i) % 32; j < size; j++)
+        bits += popcnt64_bitwise(data[j]);
+      check(bits, bits_verify, "AVX2 stream");
+    }
+#endif
+  }
+
+  cout << "libpopcnt tested successfully!" << endl;
+
+  return 0;
+}
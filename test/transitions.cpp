@@ -0,0 +1,70 @@
+///
+/// @file  transitions.cpp
+/// @brief Test popcnt_transitions() and popcnt_runs()
+///        against a simple bit by bit implementation.
+///
+/// Copyright (C) 2026 Kim Walisch, <kim.walisch@gmail.com>
+///
+/// This file is distributed under the BSD License. See the LICENSE
+/// file in the top level directory.
+///
+
+#include <libpopcnt.h>
+
+#include <iostream>
+#include <vector>
+#include <ctime>
+#include <cstdlib>
+#include <stdint.h>
+
+using namespace std;
+
+void check(bool ok, const char* name)
+{
+  if (!ok)
+  {
+    cerr << endl;
+    cerr << "libpopcnt " << name << " test failed!" << endl;
+    exit(1);
+  }
+}
+
+int main()
+{
+  srand((unsigned) time(0));
+
+  vector<uint8_t> data(20000 + 1);
+
+  for (size_t size = 0; size < data.size(); size += (size < 300) ? 1 : 1 + rand() % 500)
+  {
+    // Long runs of 0 and 1 bits
+    for (size_t i = 0; i < data.size(); i++)
+    {
+      int r = rand() % 8;
+      data[i] = (r < 3) ? 0 : (r < 6) ? 0xff : (uint8_t) rand();
+    }
+
+    for (size_t offset = 0; offset <= 1; offset++)
+    {
+      const uint8_t* ptr = &data[offset];
+      uint64_t transitions = 0;
+      uint64_t runs = 0;
+      int prev = 0;
+
+      for (size_t x = 0; x < size * 8; x++)
+      {
+        int bit = (ptr[x / 8] >> (x % 8)) & 1;
+        transitions += bit != prev;
+        runs += bit && !prev;
+        prev = bit;
+      }
+
+      check(popcnt_transitions(ptr, size) == transitions, "popcnt_transitions()");
+      check(popcnt_runs(ptr, size) == runs, "popcnt_runs()");
+    }
+  }
+
+  cout << "libpopcnt tested successfully!" << endl;
+
+  return 0;
+}
@@ -0,0 +1,98 @@
+///
+/// @file  vertical.cpp
+/// @brief Test popcnt_vertical() and popcnt_at_least()
+///        against a simple bit by bit implementation.
+///
+/// Copyright (C) 2026 Kim Walisch, <kim.walisch@gmail.com>
+///
+/// This file is distributed under the BSD License. See the LICENSE
+/// file in the top level directory.
+///
+
+#include <libpopcnt.h>
+
+#include <iostream>
+#include <vector>
+#include <ctime>
+#include <cstdlib>
+#include <stdint.h>
+
+using namespace std;
+
+void check(bool ok, const char* name)
+{
+  if (!ok)
+  {
+    cerr << endl;
+    cerr << "libpopcnt " << name << " test failed!" << endl;
+    exit(1);
+  }
+}
+
+int main()
+{
+  srand((unsigned) time(0));
+
+  size_t sizes[] = { 0, 1, 7, 8, 31, 32, 63, 64, 100, 128, 1000, 4099 };
+  int ns[] = { 1, 2, 3, 4, 5, 7, 8, 15, 16, 17, 31, 64, 100 };
+
+  for (size_t size : sizes)
+  {
+    for (int n : ns)
+    {
+      vector<vector<uint8_t>> data(n, vector<uint8_t>(size + 1));
+      vector<const void*> bitmaps(n);
+
+      for (int k = 0; k < n; k++)
+      {
+        // Bitmaps with different densities
+        int density = rand() % 4;
+        for (size_t i = 0; i < data[k].size(); i++)
+          data[k][i] = (uint8_t) ((density == 0) ? rand() & rand() : (density == 1) ? rand() | rand() : rand());
+        bitmaps[k] = &data[k][k % 2];
+      }
+
+      vector<int> counts(size * 8, 0);
+
+      for (size_t x = 0; x < size * 8; x++)
+        for (int k = 0; k < n; k++)
+          counts[x] += (((const uint8_t*) bitmaps[k])[x / 8] >> (x % 8)) & 1;
+
+      int planes_n = popcnt_vertical_planes(n);
+      vector<uint8_t> planes(planes_n * size + 1, 0);
+      popcnt_vertical(bitmaps.data(), n, size, planes.data());
+
+      for (size_t x = 0; x < size * 8; x++)
+      {
+        int count = 0;
+        for (int j = 0; j < planes_n; j++)
+          count |= ((planes[j * size + x / 8] >> (x % 8)) & 1) << j;
+        check(count == counts[x], "popcnt_vertical()");
+      }
+
+      int ms[] = { 0, 1, n / 2, (n + 1) / 2, n, n + 1 };
+
+      for (int m : ms)
+      {
+        vector<uint8_t> out(size + 1, 0xAB);
+        uint64_t cnt = popcnt_at_least(bitmaps.data(), n, size, m, out.data());
+        uint64_t cnt_verify = 0;
+
+        for (size_t x = 0; x < size * 8; x++)
+        {
+          int bit = counts[x] >= m;
+          cnt_verify += bit;
+          check(((out[x / 8] >> (x % 8)) & 1) == bit, "popcnt_at_least()");
+        }
+
+        check(out[size] == 0xAB, "popcnt_at_least()");
+        check(cnt == cnt_verify, "popcnt_at_least()");
+        check(popcnt_at_least(bitmaps.data(), n, size, m, NULL) == cnt_verify, "popcnt_at_least()");
+      }
+    }
+  }
+
+  cout << "libpopcnt tested successfully!" << endl;
+
+  return 0;
+}